@@ -270,6 +270,7 @@ public:
         if (_vm.count("export-point-sprites"))
             _writePointSpritePositions();
 
+        _eventSource->setFrameWindow(frameRange);
         for (uint32_t i = frameRange.x(); i < frameRange.y(); ++i)
         {
             std::string filename = _outputFile;
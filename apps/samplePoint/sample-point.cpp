@@ -103,6 +103,7 @@ public:
              << "# - Point sampled: " << _point << "\n"
              << std::endl;
 
+        eventSource->setFrameWindow(frameRange);
         for (uint32_t i = frameRange.x(); i < frameRange.y(); ++i)
         {
             eventSource->setFrame(i);
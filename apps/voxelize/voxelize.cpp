@@ -67,6 +67,7 @@ void _sample(ImageSourcePtr source, const vmml::Vector2ui& frameRange,
     _getNameAndExtension(filePath, outputName, extension);
 
     const size_t numDigits = std::to_string(frameRange.y()).length();
+    source->getEventSource()->setFrameWindow(frameRange);
     for (uint32_t i = frameRange.x(); i < frameRange.y(); ++i)
     {
         source->getEventSource()->setFrame(i);
@@ -113,7 +114,7 @@ public:
             ("decompose", po::value<fivox::Vector2ui>(),
              "'rank size' data-decomposition for parallel job submission")
             ("export-events", po::value<std::string>(),
-             "Name of the output events file (binary format)");
+             "Name of the output events file (binary format version 2)");
 //! [VoxelizeParameters]
         // clang-format on
     }
@@ -166,7 +167,7 @@ public:
 
         if (_vm.count("export-events"))
             loader->write(_vm["export-events"].as<std::string>(),
-                          fivox::EventFileFormat::binary);
+                          fivox::EventFileFormat::mapped);
 
         const std::string& datatype(_vm["datatype"].as<std::string>());
         if (datatype == "char")
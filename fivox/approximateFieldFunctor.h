@@ -0,0 +1,98 @@
+/* Copyright (c) 2017, EPFL/Blue Brain Project
+ *
+ * This file is part of Fivox <https://github.com/BlueBrain/Fivox>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef FIVOX_APPROXIMATEFIELDFUNCTOR_H
+#define FIVOX_APPROXIMATEFIELDFUNCTOR_H
+
+#include <fivox/api.h>
+#include <fivox/eventFunctor.h> // base class
+#include <fivox/eventOctree.h>  // member
+#include <fivox/eventSource.h>
+#include <fivox/kernels.h>
+
+namespace fivox
+{
+/**
+ * Approximates the FieldFunctor with the Barnes-Hut method.
+ *
+ * Groups of distant events are replaced by the monopole and dipole moments
+ * of their values, see EventOctree::sampleField(). The cost per voxel grows
+ * with the logarithm of the number of events within the cutoff distance,
+ * instead of linearly.
+ */
+template <typename TImage>
+class ApproximateFieldFunctor : public EventFunctor<TImage>
+{
+    typedef EventFunctor<TImage> Super;
+    typedef typename Super::TPixel TPixel;
+    typedef typename Super::TPoint TPoint;
+    typedef typename Super::TSpacing TSpacing;
+
+public:
+    /**
+     * @param theta the opening angle below which groups of events are
+     *        approximated, 0 for the exact field.
+     */
+    FIVOX_API explicit ApproximateFieldFunctor(const float theta = 0.5f)
+        : Super()
+        , _theta(theta)
+    {
+    }
+    FIVOX_API virtual ~ApproximateFieldFunctor() {}
+    /** @return the opening angle below which events are approximated. */
+    FIVOX_API float getTheta() const { return _theta; }
+    /** Build the octree with the values of the current frame. */
+    FIVOX_API void beforeGenerate() override
+    {
+        if (Super::_source)
+            _octree.build(*Super::_source);
+    }
+
+    FIVOX_API bool isLinear() const override { return true; }
+
+    FIVOX_API TPixel operator()(const TPoint& point,
+                                const TSpacing&) const override
+    {
+        if (!Super::_source)
+            return 0;
+
+        const Vector3f position(point[0], point[1], point[2]);
+        const float cutOffDistance = Super::_source->getCutOffDistance();
+
+        // beforeGenerate() was not called since the events or values
+        // changed, e.g. when sampling single points
+        if (!_octree.isCurrent(*Super::_source))
+        {
+            return kernels::sampleField(Super::_source->getPositionsX(),
+                                        Super::_source->getPositionsY(),
+                                        Super::_source->getPositionsZ(),
+                                        Super::_source->getRadii(),
+                                        Super::_source->getValues(), 0,
+                                        Super::_source->getNumEvents(),
+                                        position, cutOffDistance);
+        }
+        return _octree.sampleField(position, cutOffDistance, _theta);
+    }
+
+private:
+    const float _theta;
+    EventOctree _octree;
+};
+}
+
+#endif
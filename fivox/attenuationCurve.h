@@ -109,6 +109,12 @@ public:
         return t * attenuation + (1.f - t) * _dyeCurve[index];
     }
 
+    /** @return the normalized attenuation values, empty if not loaded. */
+    const std::vector<float>& getCurve() const { return _dyeCurve; }
+
+    /** @return the thickness of the circuit. */
+    float getThickness() const { return _thickness; }
+
 private:
     std::vector<float> _dyeCurve;
     float _thickness;
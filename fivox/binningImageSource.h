@@ -0,0 +1,88 @@
+/* Copyright (c) 2017, EPFL/Blue Brain Project
+ *
+ * This file is part of Fivox <https://github.com/BlueBrain/Fivox>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef FIVOX_BINNINGIMAGESOURCE_H
+#define FIVOX_BINNINGIMAGESOURCE_H
+
+#include <fivox/imageSource.h>
+#include <fivox/types.h>
+
+namespace fivox
+{
+/**
+ * Image source reducing the events into the voxel they fall into, like the
+ * DensityFunctor or the FrequencyFunctor, without a spatial index.
+ *
+ * The voxel of each event is computed once and the events are sorted by row
+ * of voxels along X. Each thread then reduces the rows of its region, so the
+ * cost is O(N + V) for N events and V voxels. Unlike the functors, events on
+ * the boundary between two voxels are only counted in one of them.
+ */
+template <typename TImage>
+class BinningImageSource : public ImageSource<TImage>
+{
+public:
+    /** Standard class typedefs. */
+    typedef BinningImageSource Self;
+    typedef ImageSource<TImage> Superclass;
+    typedef itk::SmartPointer<Self> Pointer;
+    typedef itk::SmartPointer<const Self> ConstPointer;
+
+    /** Method for creation through the object factory. */
+    itkNewMacro(Self)
+
+        /** Run-time type information (and related methods). */
+        itkTypeMacro(BinningImageSource, ImageSource)
+
+        /**
+         * Set the reduction of the events in a voxel, FunctorType::density
+         * for the sum of the values per volume (default) or
+         * FunctorType::frequency for the maximum value.
+         */
+        void setFunctorType(FunctorType type);
+
+    /** @return the reduction of the events in a voxel. */
+    FunctorType getFunctorType() const;
+
+protected:
+    BinningImageSource();
+    virtual ~BinningImageSource() {}
+    BinningImageSource(const BinningImageSource&) = delete;
+    void operator=(const BinningImageSource&) = delete;
+
+    void BeforeThreadedGenerateData() override;
+
+    void ThreadedGenerateData(
+        const typename Superclass::ImageRegionType& outputRegionForThread,
+        itk::ThreadIdType threadId) override;
+
+private:
+    FunctorType _functorType;
+
+    // the events of the current frame sorted by row of voxels
+    std::vector<size_t> _rowStart; // with one trailing element
+    std::vector<uint32_t> _columns;
+    std::vector<float> _values;
+};
+
+} // end namespace fivox
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "binningImageSource.hxx"
+#endif
+#endif
@@ -0,0 +1,171 @@
+/* Copyright (c) 2017, EPFL/Blue Brain Project
+ *
+ * This file is part of Fivox <https://github.com/BlueBrain/Fivox>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef FIVOX_BINNINGIMAGESOURCE_HXX
+#define FIVOX_BINNINGIMAGESOURCE_HXX
+
+#include "binningImageSource.h"
+#include "eventSource.h"
+#include "kernels.h"
+
+#include <itkImageLinearIteratorWithIndex.h>
+#include <itkProgressReporter.h>
+
+#include <lunchbox/debug.h>
+
+namespace fivox
+{
+
+template< typename TImage >
+BinningImageSource< TImage >::BinningImageSource()
+    : ImageSource< TImage >()
+    , _functorType( FunctorType::density )
+{
+}
+
+template< typename TImage >
+void BinningImageSource< TImage >::setFunctorType( const FunctorType type )
+{
+    if( type != FunctorType::density && type != FunctorType::frequency )
+        LBTHROW( std::invalid_argument( "Binning only supports the density "
+                                        "and frequency functors" ));
+    _functorType = type;
+    this->Modified();
+}
+
+template< typename TImage >
+FunctorType BinningImageSource< TImage >::getFunctorType() const
+{
+    return _functorType;
+}
+
+template< typename TImage >
+void BinningImageSource< TImage >::BeforeThreadedGenerateData()
+{
+    Superclass::_progressObserver->reset();
+
+    auto source = Superclass::_eventSource;
+    const ssize_t updatedEvents = source->load();
+    const float time = source->getCurrentTime();
+    if( updatedEvents < 0 )
+    {
+        LBERROR << "Timestamp " << time << "ms not loaded, no data or events"
+                << std::endl;
+    }
+    else
+    {
+        LBINFO << "Timestamp " << time << "ms loaded, updated " << updatedEvents
+               << " event(s)" << std::endl;
+    }
+
+    auto image = Superclass::GetOutput();
+    const auto& region = image->GetRequestedRegion();
+    Vector3f origin, invSpacing;
+    Vector3ui size;
+    for( size_t i = 0; i < 3; ++i )
+    {
+        invSpacing[i] = 1.f / image->GetSpacing()[i];
+        origin[i] = image->GetOrigin()[i] +
+                    region.GetIndex()[i] * image->GetSpacing()[i];
+        size[i] = region.GetSize()[i];
+    }
+
+    const size_t numEvents = source->getNumEvents();
+    std::vector< int64_t > indices( numEvents );
+    kernels::computeVoxelIndices( source->getPositionsX(),
+                                  source->getPositionsY(),
+                                  source->getPositionsZ(), numEvents, origin,
+                                  invSpacing, size, indices.data( ));
+
+    // counting sort of the events by row, keeping their order within a row
+    // so the sums do not depend on the number of threads
+    const size_t numRows = size_t( size[1] ) * size[2];
+    _rowStart.assign( numRows + 1, 0 );
+    for( const int64_t index : indices )
+        if( index >= 0 )
+            ++_rowStart[index / size[0] + 1];
+
+    for( size_t i = 0; i < numRows; ++i )
+        _rowStart[i + 1] += _rowStart[i];
+
+    const float* values = source->getValues();
+    _columns.resize( _rowStart[numRows] );
+    _values.resize( _rowStart[numRows] );
+    std::vector< size_t > next( _rowStart.begin(), _rowStart.end() - 1 );
+    for( size_t i = 0; i < numEvents; ++i )
+    {
+        if( indices[i] < 0 )
+            continue;
+        const size_t j = next[indices[i] / size[0]]++;
+        _columns[j] = indices[i] % size[0];
+        _values[j] = values[i];
+    }
+}
+
+template< typename TImage >
+void BinningImageSource< TImage >::ThreadedGenerateData(
+    const typename Superclass::ImageRegionType& outputRegionForThread,
+    const itk::ThreadIdType threadId )
+{
+    auto image = Superclass::GetOutput();
+    const auto& region = image->GetRequestedRegion();
+    const size_t rowSize = region.GetSize()[0];
+    const size_t numRows = region.GetSize()[1];
+    const size_t begin = outputRegionForThread.GetIndex()[0] -
+                         region.GetIndex()[0];
+    const size_t end = begin + outputRegionForThread.GetSize()[0];
+    itk::ProgressReporter progress( this, threadId,
+                                    outputRegionForThread.GetSize()[1] *
+                                    outputRegionForThread.GetSize()[2] );
+
+    const auto& spacing = image->GetSpacing();
+    const float invVolume = 1.f / std::abs( spacing[0] * spacing[1] *
+                                            spacing[2] );
+    const bool isDensity = _functorType == FunctorType::density;
+    std::vector< float > line( rowSize );
+
+    typedef itk::ImageLinearIteratorWithIndex< TImage > ImageIterator;
+    ImageIterator i( image, outputRegionForThread );
+    i.SetDirection( 0 );
+    for( i.GoToBegin(); !i.IsAtEnd(); i.NextLine( ))
+    {
+        const auto& index = i.GetIndex();
+        const size_t row = ( index[1] - region.GetIndex()[1] ) +
+                           ( index[2] - region.GetIndex()[2] ) * numRows;
+
+        std::fill( line.begin() + begin, line.begin() + end, 0.f );
+        for( size_t j = _rowStart[row]; j < _rowStart[row + 1]; ++j )
+        {
+            const size_t column = _columns[j];
+            if( column < begin || column >= end )
+                continue;
+            if( isDensity )
+                line[column] += _values[j];
+            else
+                line[column] = std::max( line[column], _values[j] );
+        }
+
+        for( size_t j = begin; j < end; ++j, ++i )
+            i.Set( isDensity ? line[j] * invVolume : line[j] );
+        progress.CompletedPixel();
+    }
+}
+
+} // end namespace fivox
+
+#endif
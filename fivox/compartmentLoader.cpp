@@ -44,30 +44,34 @@ public:
         : _output(output)
         , _report(params.getConfig().getReportSource(params.getReport()),
                   brion::MODE_READ, params.getGIDs())
+        , _frames(_report, params.getReadAhead())
     {
-        const brain::Circuit circuit(params.getConfig());
-        const auto morphologies =
-            circuit.loadMorphologies(params.getGIDs(),
-                                     brain::Circuit::Coordinates::global);
-
-        helpers::addCompartmentEvents(morphologies, _report, output);
+        helpers::addCompartmentEvents(params, _report, output);
     }
 
     ssize_t load()
     {
-        const brion::floatsPtr values =
-            _report.loadFrame(_output.getCurrentTime()).get();
+        const brion::floatsPtr values = _frames.load(_output);
         if (!values)
             return -1;
 
-        for (size_t i = 0; i != values->size(); ++i)
-            _output[i] = (*values)[i];
+        // the events are created in the order of the report buffer, unless
+        // sorted spatially
+        const uint32_t* order = _output.getGeometry()->getOrder();
+        if (!order && values->size() == _output.getNumEvents())
+        {
+            _output.adoptValues(values->data(), values);
+            return values->size();
+        }
 
+        for (size_t i = 0; i != values->size(); ++i)
+            _output[i] = (*values)[order ? order[i] : i];
         return values->size();
     }
 
     EventSource& _output;
     brion::CompartmentReport _report;
+    helpers::FramePrefetcher _frames;
 };
 
 CompartmentLoader::CompartmentLoader(const URIHandler& params)
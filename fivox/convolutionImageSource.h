@@ -0,0 +1,87 @@
+/* Copyright (c) 2017, EPFL/Blue Brain Project
+ *
+ * This file is part of Fivox <https://github.com/BlueBrain/Fivox>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef FIVOX_CONVOLUTIONIMAGESOURCE_H
+#define FIVOX_CONVOLUTIONIMAGESOURCE_H
+
+#include <fivox/imageSource.h>
+#include <fivox/types.h>
+
+namespace fivox
+{
+/**
+ * Image source computing the field of the FieldFunctor with one convolution
+ * of the volume, instead of sampling the events for each voxel.
+ *
+ * The event values are added to their nearest voxel on a grid which extends
+ * the volume by the cutoff distance, which is then convolved by FFT with the
+ * truncated 1/r^2 kernel. The field of the events on the voxels close to
+ * them, see setNearFieldRadius(), is computed exactly with the radius
+ * clamping of the FieldFunctor. The cost is O(V log V + N) for V voxels and N
+ * events, independent of the cutoff distance.
+ *
+ * Further away, each event is displaced by up to half a voxel, so the error
+ * per event decays with the distance in voxels. Events which are further
+ * than the cutoff distance or the size of the volume away from it are
+ * ignored, and events with a radius larger than the near field are not
+ * clamped beyond it.
+ */
+template <typename TImage>
+class ConvolutionImageSource : public ImageSource<TImage>
+{
+public:
+    /** Standard class typedefs. */
+    typedef ConvolutionImageSource Self;
+    typedef ImageSource<TImage> Superclass;
+    typedef itk::SmartPointer<Self> Pointer;
+    typedef itk::SmartPointer<const Self> ConstPointer;
+
+    /** Method for creation through the object factory. */
+    itkNewMacro(Self)
+
+        /** Run-time type information (and related methods). */
+        itkTypeMacro(ConvolutionImageSource, ImageSource)
+
+        /**
+         * Set the distance in voxels along each dimension around the
+         * nearest voxel of an event, within which its field is computed
+         * exactly. Defaults to 1, i.e. 27 voxels per event.
+         */
+        void setNearFieldRadius(size_t radius);
+
+    /** @return the distance in voxels of the exact near field. */
+    size_t getNearFieldRadius() const;
+
+protected:
+    ConvolutionImageSource();
+    virtual ~ConvolutionImageSource() {}
+    ConvolutionImageSource(const ConvolutionImageSource&) = delete;
+    void operator=(const ConvolutionImageSource&) = delete;
+
+    void GenerateData() override;
+
+private:
+    size_t _nearFieldRadius;
+};
+
+} // end namespace fivox
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "convolutionImageSource.hxx"
+#endif
+#endif
@@ -0,0 +1,224 @@
+/* Copyright (c) 2017, EPFL/Blue Brain Project
+ *
+ * This file is part of Fivox <https://github.com/BlueBrain/Fivox>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef FIVOX_CONVOLUTIONIMAGESOURCE_HXX
+#define FIVOX_CONVOLUTIONIMAGESOURCE_HXX
+
+#include "convolutionImageSource.h"
+#include "eventSource.h"
+#include "kernels.h"
+
+#include <itkConstantBoundaryCondition.h>
+#include <itkFFTConvolutionImageFilter.h>
+#include <itkImageRegionConstIterator.h>
+#include <itkImageRegionIterator.h>
+#include <itkImageRegionIteratorWithIndex.h>
+#include <itkProgressReporter.h>
+
+#include <lunchbox/clock.h>
+
+namespace fivox
+{
+
+template< typename TImage >
+ConvolutionImageSource< TImage >::ConvolutionImageSource()
+    : ImageSource< TImage >()
+    , _nearFieldRadius( 1 )
+{
+}
+
+template< typename TImage >
+void ConvolutionImageSource< TImage >::setNearFieldRadius( const size_t radius )
+{
+    _nearFieldRadius = radius;
+    this->Modified();
+}
+
+template< typename TImage >
+size_t ConvolutionImageSource< TImage >::getNearFieldRadius() const
+{
+    return _nearFieldRadius;
+}
+
+template< typename TImage >
+void ConvolutionImageSource< TImage >::GenerateData()
+{
+    Superclass::_progressObserver->reset();
+
+    auto image = Superclass::GetOutput();
+    image->Allocate();
+
+    auto source = Superclass::_eventSource;
+    if( source->load() < 0 )
+    {
+        LBERROR << "Timestamp " << source->getCurrentTime()
+                << "ms not loaded, no data or events" << std::endl;
+    }
+
+    // deposition, convolution and near field
+    itk::ProgressReporter progress( this, 0, 3 );
+    lunchbox::Clock clock;
+
+    // the event grid extends the volume by the cutoff distance, but at most by
+    // the size of the volume. The kernel spans from any grid voxel to any
+    // volume voxel within the cutoff distance.
+    const auto& region = image->GetBufferedRegion();
+    const auto& spacing = image->GetSpacing();
+    const float cutOffDistance = source->getCutOffDistance();
+    FloatVolume::SizeType gridSize, kernelSize;
+    FloatVolume::IndexType padding;
+    Vector3f origin, gridOrigin, invSpacing;
+    Vector3ui size, kernelRadius;
+    for( size_t i = 0; i < 3; ++i )
+    {
+        size[i] = region.GetSize()[i];
+        const unsigned cutOff = std::ceil( cutOffDistance / spacing[i] );
+        padding[i] = std::min( cutOff, size[i] );
+        kernelRadius[i] = std::min( cutOff, unsigned( size[i] - 1 +
+                                                      padding[i] ));
+        gridSize[i] = size[i] + 2 * padding[i];
+        kernelSize[i] = 2 * kernelRadius[i] + 1;
+        invSpacing[i] = 1.f / spacing[i];
+        origin[i] = image->GetOrigin()[i] + region.GetIndex()[i] * spacing[i];
+        gridOrigin[i] = origin[i] - padding[i] * spacing[i];
+    }
+
+    const size_t numEvents = source->getNumEvents();
+    const float* posx = source->getPositionsX();
+    const float* posy = source->getPositionsY();
+    const float* posz = source->getPositionsZ();
+    const float* radii = source->getRadii();
+    const float* values = source->getValues();
+
+    // add the events to their nearest grid voxel
+    FloatVolume::Pointer grid = FloatVolume::New();
+    grid->SetRegions( gridSize );
+    grid->SetSpacing( spacing );
+    grid->Allocate();
+    grid->FillBuffer( 0.f );
+
+    std::vector< int64_t > indices( numEvents );
+    kernels::computeVoxelIndices( posx, posy, posz, numEvents, gridOrigin,
+                                  invSpacing,
+                                  Vector3ui( gridSize[0], gridSize[1],
+                                             gridSize[2] ),
+                                  indices.data( ));
+    float* gridBuffer = grid->GetBufferPointer();
+    for( size_t i = 0; i < numEvents; ++i )
+        if( indices[i] >= 0 )
+            gridBuffer[indices[i]] += values[i];
+    progress.CompletedPixel();
+
+    // truncated 1/r^2 kernel, without the near field
+    FloatVolume::Pointer kernel = FloatVolume::New();
+    kernel->SetRegions( kernelSize );
+    kernel->SetSpacing( spacing );
+    kernel->Allocate();
+
+    const float cutOffDistance2 = cutOffDistance * cutOffDistance;
+    itk::ImageRegionIteratorWithIndex< FloatVolume > k(
+        kernel, kernel->GetBufferedRegion( ));
+    for( k.GoToBegin(); !k.IsAtEnd(); ++k )
+    {
+        float distance2 = 0.f;
+        bool isNear = true;
+        for( size_t i = 0; i < 3; ++i )
+        {
+            const long offset = k.GetIndex()[i] - long( kernelRadius[i] );
+            const float distance = offset * spacing[i];
+            distance2 += distance * distance;
+            isNear = isNear && size_t( std::abs( offset )) <= _nearFieldRadius;
+        }
+        k.Set( isNear || distance2 > cutOffDistance2 ? 0.f : 1.f / distance2 );
+    }
+
+    // the grid is zero-padded, only the volume within it is computed
+    typedef itk::FFTConvolutionImageFilter< FloatVolume > Convolution;
+    itk::ConstantBoundaryCondition< FloatVolume > zero;
+    Convolution::Pointer convolution = Convolution::New();
+    convolution->SetInput( grid );
+    convolution->SetKernelImage( kernel );
+    convolution->SetBoundaryCondition( &zero );
+    convolution->NormalizeOff();
+    convolution->SetOutputRegionModeToSame();
+
+    const FloatVolume::RegionType volumeRegion(
+        padding, FloatVolume::SizeType{{ size[0], size[1], size[2] }} );
+    convolution->GetOutput()->SetRequestedRegion( volumeRegion );
+    convolution->Update();
+    progress.CompletedPixel();
+
+    // exact field of the events within the near field radius of their voxel
+    std::vector< float > nearField( size_t( size[0] ) * size[1] * size[2] );
+    const long nearFieldRadius = _nearFieldRadius;
+    for( size_t i = 0; i < numEvents; ++i )
+    {
+        if( indices[i] < 0 )
+            continue;
+
+        long lower[3], upper[3];
+        int64_t index = indices[i];
+        for( size_t j = 0; j < 3; ++j )
+        {
+            const long voxel = long( index % gridSize[j] ) - padding[j];
+            index /= int64_t( gridSize[j] );
+            lower[j] = std::max( voxel - nearFieldRadius, 0l );
+            upper[j] = std::min( voxel + nearFieldRadius, long( size[j] ) - 1 );
+        }
+
+        const Vector3f position( posx[i], posy[i], posz[i] );
+        for( long z = lower[2]; z <= upper[2]; ++z )
+            for( long y = lower[1]; y <= upper[1]; ++y )
+                for( long x = lower[0]; x <= upper[0]; ++x )
+                {
+                    const Vector3f voxel( origin[0] + x * spacing[0],
+                                          origin[1] + y * spacing[1],
+                                          origin[2] + z * spacing[2] );
+                    const float distance2 =
+                        ( voxel - position ).squared_length();
+                    if( distance2 > cutOffDistance2 )
+                        continue;
+
+                    // clamped within the radius, as in the FieldFunctor
+                    const float invRadius = radii[i];
+                    nearField[ x + size[0] * ( y + size[1] * z )] +=
+                        1.f / distance2 > invRadius * invRadius
+                            ? values[i] * invRadius
+                            : values[i] / distance2;
+                }
+    }
+
+    itk::ImageRegionConstIterator< FloatVolume > in( convolution->GetOutput(),
+                                                     volumeRegion );
+    itk::ImageRegionIterator< TImage > out( image, region );
+    for( const float value : nearField )
+    {
+        out.Set( in.Get() + value );
+        ++in;
+        ++out;
+    }
+    progress.CompletedPixel();
+
+    LBINFO << "Convolved " << numEvents << " events with a " << kernelSize[0]
+           << "x" << kernelSize[1] << "x" << kernelSize[2] << " kernel in "
+           << clock.getTime64() << "ms" << std::endl;
+}
+
+} // end namespace fivox
+
+#endif
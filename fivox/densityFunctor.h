@@ -44,9 +44,11 @@ public:
     FIVOX_API void beforeGenerate() override
     {
         if (Super::_source)
-            Super::_source->buildRTree();
+            Super::_source->buildIndex();
     }
 
+    FIVOX_API bool isLinear() const override { return true; }
+
     FIVOX_API TPixel operator()(const TPoint& point,
                                 const TSpacing& spacing) const override;
 };
@@ -68,14 +70,8 @@ inline typename DensityFunctor<TImage>::TPixel DensityFunctor<TImage>::
     }
 
     const AABBf region(point - spacing_2, point + spacing_2);
-    const EventValues& values = Super::_source->findEvents(region);
-
-    float sum = 0.f;
-    for (const float& value : values)
-        sum += value;
-
-    sum /= std::abs(spacing_2.product() * 8.f);
-    return sum;
+    return Super::_source->sumValues(region) /
+           std::abs(spacing_2.product() * 8.f);
 }
 }
 
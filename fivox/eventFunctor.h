@@ -44,6 +44,82 @@ public:
     FIVOX_API virtual TPixel operator()(const TPoint& point,
                                         const TSpacing& spacing) const = 0;
 
+    /**
+     * Sample a line of consecutive voxels along the X axis.
+     *
+     * The default implementation calls operator() for each voxel. Functors
+     * can override it to amortize the per-voxel overhead over the line.
+     *
+     * @param point the position of the first voxel of the line.
+     * @param spacing the voxel spacing, voxels are spacing[0] apart.
+     * @param size the number of voxels in the line.
+     * @param output the values of the line, size elements.
+     */
+    FIVOX_API virtual void sampleLine(const TPoint& point,
+                                      const TSpacing& spacing,
+                                      const size_t size, TPixel* output) const
+    {
+        TPoint voxel = point;
+        for (size_t i = 0; i < size; ++i)
+        {
+            voxel[0] = point[0] + i * spacing[0];
+            output[i] = (*this)(voxel, spacing);
+        }
+    }
+
+    /**
+     * Add the contribution of all events to a block of voxels, instead of
+     * sampling each voxel.
+     *
+     * The default implementation returns false, the image source then
+     * samples each voxel with sampleLine().
+     *
+     * @param origin the position of the first voxel of the block.
+     * @param spacing the voxel spacing.
+     * @param size the number of voxels along each dimension.
+     * @param output the values of the block with X fastest, initialized to 0.
+     * @return true if the functor supports splatting.
+     */
+    FIVOX_API virtual bool splat(const TPoint& /*origin*/,
+                                 const TSpacing& /*spacing*/,
+                                 const Vector3ui& /*size*/,
+                                 float* /*output*/) const
+    {
+        return false;
+    }
+
+    /**
+     * Add the contribution of the given events to a block of voxels, for
+     * functors which are linear in the event values. Used to update a volume
+     * with the changes of the event values since the previous frame.
+     *
+     * The default implementation returns false.
+     *
+     * @param posx, posy, posz, radii, values the events, with inverted radii
+     *        like EventSource.
+     * @param numEvents the number of events.
+     * @param origin the position of the first voxel of the block.
+     * @param spacing the voxel spacing.
+     * @param size the number of voxels along each dimension.
+     * @param output the values of the block with X fastest, to add to.
+     * @return true if the functor is linear and supports it.
+     */
+    FIVOX_API virtual bool splatEvents(
+        const float* /*posx*/, const float* /*posy*/, const float* /*posz*/,
+        const float* /*radii*/, const float* /*values*/, size_t /*numEvents*/,
+        const TPoint& /*origin*/, const TSpacing& /*spacing*/,
+        const Vector3ui& /*size*/, float* /*output*/) const
+    {
+        return false;
+    }
+
+    /**
+     * @return true if the voxel values are the sum of the contributions of
+     *         the events, so that the volumes of disjoint sets of events add
+     *         up to the volume of all of them. False by default.
+     */
+    FIVOX_API virtual bool isLinear() const { return false; }
+
 protected:
     EventSourcePtr _source;
 };
@@ -0,0 +1,552 @@
+/* Copyright (c) 2017, EPFL/Blue Brain Project
+ *
+ * This file is part of Fivox <https://github.com/BlueBrain/Fivox>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "eventGeometry.h"
+#include "eventGrid.h"
+#include "kernels.h"
+
+#include <lunchbox/debug.h>
+#include <lunchbox/log.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <limits>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fivox
+{
+namespace
+{
+// average number of events per cell of the index, for uniform events
+const float _eventsPerCell = 8.f;
+const size_t _alignBoundary = 32;
+const size_t _mortonBits = 21; // per axis, for 63 bit codes
+
+// the bits of value, 3 bits apart
+uint64_t _spreadBits(uint64_t value)
+{
+    value &= 0x1fffff;
+    value = (value | value << 32) & 0x1f00000000ffffull;
+    value = (value | value << 16) & 0x1f0000ff0000ffull;
+    value = (value | value << 8) & 0x100f00f00f00f00full;
+    value = (value | value << 4) & 0x10c30c30c30c30c3ull;
+    value = (value | value << 2) & 0x1249249249249249ull;
+    return value;
+}
+
+/** Registered geometry, or the result of its creation in progress */
+struct SharedGeometry
+{
+    std::weak_ptr<const EventGeometry> geometry;
+    std::shared_future<ConstEventGeometryPtr> pending;
+};
+std::mutex _sharedMutex;
+std::unordered_map<std::string, SharedGeometry> _shared;
+
+const uint32_t _fileMagic = 0xf1e0e7e5;
+const uint32_t _fileVersion = 1;
+const size_t _columnAlignment = 64;
+
+/**
+ * Header of a file written by EventGeometry::write(), followed by the columns
+ * of the positions along X, Y and Z, the inverted radii and the order, if
+ * any. The columns are aligned to 64 bytes, so they can be used in place.
+ */
+struct FileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint64_t numEvents;
+    uint64_t columnSize; // in bytes, including the padding
+    float boundingBox[6];
+    uint32_t hasOrder;
+    uint32_t reserved; // 0, for future use
+};
+static_assert(sizeof(FileHeader) % _columnAlignment == 0,
+              "Columns must stay aligned after the header");
+}
+
+class EventGeometry::Impl
+{
+public:
+    enum EventOffsets
+    {
+        POSX = 0,
+        POSY,
+        POSZ,
+        RADIUS,
+        NUM_OFFSETS
+    };
+
+    explicit Impl(const size_t numEvents_)
+        : numEvents(numEvents_)
+        , indexBuilt(false)
+    {
+        if (numEvents == 0)
+        {
+            std::fill(columns, columns + NUM_OFFSETS, nullptr);
+            return;
+        }
+
+        const size_t size = numEvents * EventOffsets::NUM_OFFSETS;
+        void* ptr;
+        if (posix_memalign(&ptr, _alignBoundary, size * sizeof(float)))
+        {
+            LBWARN << "Memory alignment failed. "
+                   << "Trying normal allocation" << std::endl;
+            ptr = malloc(size * sizeof(float));
+            if (!ptr)
+                LBTHROW(std::bad_alloc());
+        }
+        ::memset(ptr, 0, size * sizeof(float));
+        events.reset((float*)ptr);
+        for (size_t i = 0; i < NUM_OFFSETS; ++i)
+            columns[i] = events.get() + numEvents * i;
+    }
+
+    Impl(const size_t numEvents_, const float* posx, const float* posy,
+         const float* posz, const float* radii, const AABBf& boundingBox_,
+         std::shared_ptr<const void> owner_)
+        : numEvents(numEvents_)
+        , boundingBox(boundingBox_)
+        , owner(owner_)
+        , indexBuilt(false)
+    {
+        columns[POSX] = const_cast<float*>(posx);
+        columns[POSY] = const_cast<float*>(posy);
+        columns[POSZ] = const_cast<float*>(posz);
+        columns[RADIUS] = const_cast<float*>(radii);
+    }
+
+    float* get(const EventOffsets offset) const { return columns[offset]; }
+
+    const size_t numEvents;
+    Events events;
+    float* columns[NUM_OFFSETS]; // into events, or external if not owned
+    AABBf boundingBox;
+    std::shared_ptr<const void> owner; // of external columns
+    std::vector<uint32_t> order;       // from sortSpatially()
+
+    std::mutex updateMutex; // of the bounding box for range updates
+    mutable std::mutex indexMutex;
+    mutable std::atomic<bool> indexBuilt;
+    mutable EventGrid index;
+};
+
+EventGeometry::EventGeometry(const size_t numEvents)
+    : _impl(new Impl(numEvents))
+{
+}
+
+EventGeometry::EventGeometry(const size_t numEvents, const float* posx,
+                             const float* posy, const float* posz,
+                             const float* radii, const AABBf& boundingBox,
+                             std::shared_ptr<const void> owner)
+    : _impl(new Impl(numEvents, posx, posy, posz, radii, boundingBox, owner))
+{
+}
+
+EventGeometry::EventGeometry(const EventGeometry& from)
+    : _impl(new Impl(from.getNumEvents()))
+{
+    for (size_t i = 0; i < Impl::EventOffsets::NUM_OFFSETS; ++i)
+    {
+        const auto offset = Impl::EventOffsets(i);
+        if (_impl->numEvents > 0)
+            ::memcpy(_impl->get(offset), from._impl->get(offset),
+                     _impl->numEvents * sizeof(float));
+    }
+    _impl->boundingBox = from._impl->boundingBox;
+    _impl->order = from._impl->order;
+}
+
+EventGeometry::~EventGeometry()
+{
+}
+
+size_t EventGeometry::getNumEvents() const
+{
+    return _impl->numEvents;
+}
+
+uint64_t EventGeometry::computeHash() const
+{
+    const uint64_t numEvents = getNumEvents();
+    uint64_t hash = kernels::hashWords(&numEvents, 2);
+    hash = kernels::hashWords(getPositionsX(), numEvents, hash);
+    hash = kernels::hashWords(getPositionsY(), numEvents, hash);
+    hash = kernels::hashWords(getPositionsZ(), numEvents, hash);
+    return kernels::hashWords(getRadii(), numEvents, hash);
+}
+
+const float* EventGeometry::getPositionsX() const
+{
+    return _impl->get(Impl::EventOffsets::POSX);
+}
+
+const float* EventGeometry::getPositionsY() const
+{
+    return _impl->get(Impl::EventOffsets::POSY);
+}
+
+const float* EventGeometry::getPositionsZ() const
+{
+    return _impl->get(Impl::EventOffsets::POSZ);
+}
+
+const float* EventGeometry::getRadii() const
+{
+    return _impl->get(Impl::EventOffsets::RADIUS);
+}
+
+const AABBf& EventGeometry::getBoundingBox() const
+{
+    return _impl->boundingBox;
+}
+
+void EventGeometry::update(const size_t i, const Vector3f& pos,
+                           const float radius)
+{
+    if (i >= _impl->numEvents)
+    {
+        LBWARN << "The specified index is not valid. Event not added"
+               << std::endl;
+        return;
+    }
+    if (!_impl->events)
+        LBTHROW(std::logic_error("Cannot update external events"));
+
+    _impl->boundingBox.merge(pos);
+    _impl->get(Impl::EventOffsets::POSX)[i] = pos[0];
+    _impl->get(Impl::EventOffsets::POSY)[i] = pos[1];
+    _impl->get(Impl::EventOffsets::POSZ)[i] = pos[2];
+
+    // radius is inverted to improve performance at computing time
+    // e.g. LFP functor
+    if (std::abs(radius) > std::numeric_limits<float>::epsilon())
+        _impl->get(Impl::EventOffsets::RADIUS)[i] = 1.f / radius;
+
+    if (_impl->indexBuilt)
+    {
+        _impl->index.clear();
+        _impl->indexBuilt = false;
+    }
+}
+
+AABBf EventGeometry::update(const size_t first, const size_t count,
+                            const float* posx, const float* posy,
+                            const float* posz, const float* radii)
+{
+    if (first > _impl->numEvents || count > _impl->numEvents - first)
+        LBTHROW(std::out_of_range("EventGeometry::update: Out of range"));
+    if (!_impl->events)
+        LBTHROW(std::logic_error("Cannot update external events"));
+
+    AABBf bbox;
+    float* x = _impl->get(Impl::EventOffsets::POSX) + first;
+    float* y = _impl->get(Impl::EventOffsets::POSY) + first;
+    float* z = _impl->get(Impl::EventOffsets::POSZ) + first;
+    for (size_t i = 0; i < count; ++i)
+    {
+        x[i] = posx[i];
+        y[i] = posy[i];
+        z[i] = posz[i];
+        bbox.merge(Vector3f(posx[i], posy[i], posz[i]));
+    }
+
+    if (radii)
+    {
+        float* inverted = _impl->get(Impl::EventOffsets::RADIUS) + first;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (std::abs(radii[i]) > std::numeric_limits<float>::epsilon())
+                inverted[i] = 1.f / radii[i];
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(_impl->updateMutex);
+    _impl->boundingBox.merge(bbox);
+    if (_impl->indexBuilt)
+    {
+        _impl->index.clear();
+        _impl->indexBuilt = false;
+    }
+    return bbox;
+}
+
+void EventGeometry::sortSpatially()
+{
+    const size_t numEvents = _impl->numEvents;
+    if (numEvents > 0 && !_impl->events)
+        LBTHROW(std::logic_error("Cannot sort external events"));
+    if (numEvents < 2)
+        return;
+
+    const AABBf& bbox = _impl->boundingBox;
+    const float* posx = _impl->get(Impl::EventOffsets::POSX);
+    const float* posy = _impl->get(Impl::EventOffsets::POSY);
+    const float* posz = _impl->get(Impl::EventOffsets::POSZ);
+    const float maxCell = float((1u << _mortonBits) - 1);
+    const float scale = maxCell / std::max(bbox.getSize().find_max(), 1.f);
+    const auto toCell = [&](const float position, const size_t axis) {
+        const float cell = (position - bbox.getMin()[axis]) * scale;
+        return uint64_t(std::min(maxCell, std::max(0.f, cell)));
+    };
+
+    std::vector<std::pair<uint64_t, uint32_t>> codes(numEvents);
+    for (size_t i = 0; i < numEvents; ++i)
+    {
+        codes[i].first = _spreadBits(toCell(posx[i], 0)) |
+                         _spreadBits(toCell(posy[i], 1)) << 1 |
+                         _spreadBits(toCell(posz[i], 2)) << 2;
+        codes[i].second = i;
+    }
+    std::sort(codes.begin(), codes.end());
+
+    std::vector<float> sorted(numEvents);
+    for (size_t i = 0; i < Impl::EventOffsets::NUM_OFFSETS; ++i)
+    {
+        float* column = _impl->get(Impl::EventOffsets(i));
+        for (size_t j = 0; j < numEvents; ++j)
+            sorted[j] = column[codes[j].second];
+        std::copy(sorted.begin(), sorted.end(), column);
+    }
+
+    // compose with a previous order to keep the original indices
+    std::vector<uint32_t> order(numEvents);
+    for (size_t i = 0; i < numEvents; ++i)
+        order[i] = _impl->order.empty() ? codes[i].second
+                                        : _impl->order[codes[i].second];
+    _impl->order.swap(order);
+
+    if (_impl->indexBuilt)
+    {
+        _impl->index.clear();
+        _impl->indexBuilt = false;
+    }
+}
+
+const uint32_t* EventGeometry::getOrder() const
+{
+    return _impl->order.empty() ? nullptr : _impl->order.data();
+}
+
+const EventGrid& EventGeometry::getIndex() const
+{
+    if (_impl->indexBuilt)
+        return _impl->index;
+
+    std::lock_guard<std::mutex> lock(_impl->indexMutex);
+    if (_impl->indexBuilt)
+        return _impl->index;
+
+    const size_t numEvents = _impl->numEvents;
+    const AABBf& bbox = _impl->boundingBox;
+    float cellSize = 0.f;
+    if (numEvents > 0 && !bbox.isEmpty())
+    {
+        const Vector3f& size = bbox.getSize();
+        const float volume = std::max(size[0], 1.f) * std::max(size[1], 1.f) *
+                             std::max(size[2], 1.f);
+        cellSize = std::cbrt(volume * _eventsPerCell / numEvents);
+    }
+
+    _impl->index.build(*this, nullptr, cellSize);
+    _impl->indexBuilt = true;
+    LBDEBUG << "Indexed " << numEvents << " events with cells of "
+            << _impl->index.getCellSize() << " um" << std::endl;
+    return _impl->index;
+}
+
+bool EventGeometry::hasIndex() const
+{
+    return _impl->indexBuilt;
+}
+
+bool EventGeometry::write(const std::string& filename,
+                          const uint64_t key) const
+{
+    const size_t numEvents = _impl->numEvents;
+    FileHeader header;
+    ::memset(&header, 0, sizeof(header));
+    header.magic = _fileMagic;
+    header.version = _fileVersion;
+    header.key = key;
+    header.numEvents = numEvents;
+    header.columnSize = (numEvents * sizeof(float) + _columnAlignment - 1) /
+                        _columnAlignment * _columnAlignment;
+    for (size_t i = 0; i < 3; ++i)
+    {
+        header.boundingBox[i] = _impl->boundingBox.getMin()[i];
+        header.boundingBox[i + 3] = _impl->boundingBox.getMax()[i];
+    }
+    header.hasOrder = !_impl->order.empty();
+
+    const std::string temporary =
+        filename + "." + std::to_string(::getpid()) + ".tmp";
+    std::ofstream file(temporary, std::ios::binary);
+    const std::vector<char> padding(header.columnSize -
+                                    numEvents * sizeof(float));
+    const auto writeColumn = [&](const void* column) {
+        file.write(static_cast<const char*>(column),
+                   numEvents * sizeof(float));
+        file.write(padding.data(), padding.size());
+    };
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (size_t i = 0; i < Impl::EventOffsets::NUM_OFFSETS; ++i)
+        writeColumn(_impl->get(Impl::EventOffsets(i)));
+    if (header.hasOrder)
+        writeColumn(_impl->order.data());
+    file.close();
+
+    if (!file || ::rename(temporary.c_str(), filename.c_str()) != 0)
+    {
+        ::unlink(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+ConstEventGeometryPtr EventGeometry::read(const std::string& filename,
+                                          const uint64_t key)
+{
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || size_t(info.st_size) < sizeof(FileHeader))
+    {
+        ::close(fd);
+        return nullptr;
+    }
+
+    const size_t size = info.st_size;
+    void* address = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (address == MAP_FAILED)
+        return nullptr;
+    const std::shared_ptr<const void> mapping(address, [size](void* ptr) {
+        ::munmap(ptr, size);
+    });
+
+    const FileHeader& header = *static_cast<const FileHeader*>(address);
+    const size_t numEvents = header.numEvents;
+    const size_t columnSize = header.columnSize;
+    const size_t numColumns =
+        Impl::EventOffsets::NUM_OFFSETS + (header.hasOrder ? 1 : 0);
+    // the sizes are checked without overflows for corrupt headers
+    if (header.magic != _fileMagic || header.version != _fileVersion ||
+        header.key != key ||
+        header.numEvents > std::numeric_limits<size_t>::max() / sizeof(float) ||
+        header.columnSize > (size - sizeof(FileHeader)) / numColumns ||
+        columnSize < numEvents * sizeof(float) ||
+        columnSize % _columnAlignment != 0)
+    {
+        return nullptr;
+    }
+
+    const auto getColumn = [&](const size_t i) {
+        return reinterpret_cast<const float*>(
+            static_cast<const uint8_t*>(address) + sizeof(FileHeader) +
+            i * columnSize);
+    };
+    const AABBf bbox(Vector3f(header.boundingBox[0], header.boundingBox[1],
+                              header.boundingBox[2]),
+                     Vector3f(header.boundingBox[3], header.boundingBox[4],
+                              header.boundingBox[5]));
+    auto geometry = std::make_shared<EventGeometry>(
+        numEvents, getColumn(0), getColumn(1), getColumn(2), getColumn(3),
+        bbox, mapping);
+    if (header.hasOrder)
+    {
+        const uint32_t* order = reinterpret_cast<const uint32_t*>(
+            getColumn(Impl::EventOffsets::NUM_OFFSETS));
+        geometry->_impl->order.assign(order, order + numEvents);
+    }
+    return geometry;
+}
+
+ConstEventGeometryPtr EventGeometry::getShared(
+    const std::string& key,
+    const std::function<ConstEventGeometryPtr()>& create)
+{
+    // create() runs without the lock, so geometries of other keys are
+    // shared meanwhile, and other users of the key wait for its result
+    std::promise<ConstEventGeometryPtr> promise;
+    std::shared_future<ConstEventGeometryPtr> pending;
+    {
+        std::lock_guard<std::mutex> lock(_sharedMutex);
+        SharedGeometry& entry = _shared[key];
+        ConstEventGeometryPtr geometry = entry.geometry.lock();
+        if (geometry)
+        {
+            LBINFO << "Sharing " << geometry->getNumEvents() << " events of "
+                   << key << std::endl;
+            return geometry;
+        }
+        if (entry.pending.valid())
+            pending = entry.pending;
+        else
+            entry.pending = promise.get_future().share();
+    }
+
+    if (pending.valid())
+        return pending.get(); // rethrows the exception of create()
+
+    // entries of released geometries are only replaced, the number of keys
+    // is bounded by the data sets loaded in the process
+    ConstEventGeometryPtr geometry;
+    try
+    {
+        geometry = create();
+    }
+    catch (...)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_sharedMutex);
+            _shared[key].pending = std::shared_future<ConstEventGeometryPtr>();
+        }
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_sharedMutex);
+        SharedGeometry& entry = _shared[key];
+        entry.geometry = geometry;
+        entry.pending = std::shared_future<ConstEventGeometryPtr>();
+    }
+    promise.set_value(geometry);
+    return geometry;
+}
+}
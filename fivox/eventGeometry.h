@@ -0,0 +1,187 @@
+/* Copyright (c) 2017, EPFL/Blue Brain Project
+ *
+ * This file is part of Fivox <https://github.com/BlueBrain/Fivox>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef FIVOX_EVENTGEOMETRY_H
+#define FIVOX_EVENTGEOMETRY_H
+
+#include <fivox/api.h>
+#include <fivox/types.h>
+
+#include <functional>
+
+namespace fivox
+{
+/**
+ * Positions and radii of a set of events, without their values.
+ *
+ * A geometry is filled with update() after construction and is read-only
+ * once shared, e.g. by several EventSource for the same circuit, or by the
+ * frames of one source. The spatial index over the positions is built on
+ * first use and shared as well.
+ */
+class EventGeometry
+{
+public:
+    /** Create a geometry of numEvents events at the origin. */
+    FIVOX_API explicit EventGeometry(size_t numEvents = 0);
+
+    /**
+     * Use the given columns of events in place, e.g. from a mapped file.
+     *
+     * @param numEvents the number of events.
+     * @param posx, posy, posz, radii the events, with inverted radii.
+     * @param boundingBox the bounding box of the event positions.
+     * @param owner keeps the columns alive as long as the geometry.
+     */
+    FIVOX_API EventGeometry(size_t numEvents, const float* posx,
+                            const float* posy, const float* posz,
+                            const float* radii, const AABBf& boundingBox,
+                            std::shared_ptr<const void> owner);
+
+    /** Copy the events of the given geometry, but not its index. */
+    FIVOX_API EventGeometry(const EventGeometry& from);
+
+    FIVOX_API ~EventGeometry();
+
+    EventGeometry& operator=(const EventGeometry&) = delete;
+
+    /** @return the number of events. */
+    FIVOX_API size_t getNumEvents() const;
+
+    /** @name Event attributes, see EventSource getters. */
+    //@{
+    FIVOX_API const float* getPositionsX() const;
+    FIVOX_API const float* getPositionsY() const;
+    FIVOX_API const float* getPositionsZ() const;
+    FIVOX_API const float* getRadii() const;
+    //@}
+
+    /** @return the bounding box of the event positions. */
+    FIVOX_API const AABBf& getBoundingBox() const;
+
+    /**
+     * @return a hash of the number, positions and radii of the events, see
+     *         kernels::hashWords().
+     */
+    FIVOX_API uint64_t computeHash() const;
+
+    /**
+     * Set the position and radius of the given event. Not thread safe, must
+     * not be called once the geometry is shared.
+     *
+     * @throw std::logic_error for events used in place.
+     *
+     * @param i the index of the event, smaller than getNumEvents().
+     * @param pos the event position.
+     * @param radius the event radius, stored inverted.
+     */
+    FIVOX_API void update(size_t i, const Vector3f& pos, float radius);
+
+    /**
+     * Set the positions and radii of the events [first, first + count).
+     * Thread safe for disjoint ranges, must not be called once the geometry
+     * is shared.
+     *
+     * @throw std::logic_error for events used in place.
+     * @throw std::out_of_range if the range exceeds getNumEvents().
+     *
+     * @param first the index of the first event to set.
+     * @param count the number of events to set.
+     * @param posx, posy, posz the event positions.
+     * @param radii the event radii, stored inverted, or nullptr to keep the
+     *        current radii.
+     * @return the bounding box of the given positions.
+     */
+    FIVOX_API AABBf update(size_t first, size_t count, const float* posx,
+                          const float* posy, const float* posz,
+                          const float* radii);
+
+    /**
+     * Reorder the events along a Morton curve of their bounding box, so that
+     * events close in space are close in memory. Must not be called once the
+     * geometry is shared.
+     *
+     * The indices of update() and of the values of an EventSource follow the
+     * new order, use getOrder() to map them to the previous ones.
+     *
+     * @throw std::logic_error for events used in place.
+     */
+    FIVOX_API void sortSpatially();
+
+    /**
+     * @return the index of each event before sortSpatially(), or nullptr if
+     *         the events were not sorted.
+     */
+    FIVOX_API const uint32_t* getOrder() const;
+
+    /**
+     * @return the spatial index over the event positions, built on the first
+     *         call. Thread safe.
+     */
+    FIVOX_API const EventGrid& getIndex() const;
+
+    /** @return true if getIndex() was called since the last update(). */
+    FIVOX_API bool hasIndex() const;
+
+    /**
+     * Write the events and their order to a file which read() maps in place.
+     * The file is written under a temporary name and renamed, so concurrent
+     * readers only see complete files.
+     *
+     * @param filename the file to write.
+     * @param key identifies the events, e.g. a hash of what they are created
+     *        from.
+     * @return false if the file could not be written.
+     */
+    FIVOX_API bool write(const std::string& filename, uint64_t key) const;
+
+    /**
+     * Map the events of a file written by write() for the given key.
+     *
+     * @param filename the file to map.
+     * @param key identifies the events, as given to write().
+     * @return the events used in place, or nullptr if the file does not
+     *         exist, is invalid or was written for another key.
+     */
+    FIVOX_API static ConstEventGeometryPtr read(const std::string& filename,
+                                                uint64_t key);
+
+    /**
+     * Get the geometry registered with the given key, or create and
+     * register it.
+     *
+     * Geometries are registered weakly, and released with the last user.
+     * Thread safe. The geometry is created without locking the registry,
+     * concurrent calls for the same key wait for it and share it.
+     *
+     * @param key identifies the events, e.g. the circuit and report they
+     *        are created from.
+     * @param create the function creating the geometry if not registered.
+     * @return the registered geometry.
+     */
+    FIVOX_API static ConstEventGeometryPtr getShared(
+        const std::string& key,
+        const std::function<ConstEventGeometryPtr()>& create);
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> _impl;
+};
+}
+
+#endif
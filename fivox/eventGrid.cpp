@@ -0,0 +1,186 @@
+/* Copyright (c) 2017, EPFL/Blue Brain Project
+ *
+ * This file is part of Fivox <https://github.com/BlueBrain/Fivox>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "eventGrid.h"
+#include "eventGeometry.h"
+#include "eventSource.h"
+
+#include <lunchbox/log.h>
+
+#include <cmath>
+
+namespace fivox
+{
+namespace
+{
+// upper limit for the cell table, cells grow beyond the requested size above
+const size_t _maxCells = 1 << 22;
+
+size_t _toCell(const float coordinate, const size_t numCells)
+{
+    // clamp in floating point to avoid overflows for points far off the grid
+    return std::min(float(numCells), std::max(0.f, std::floor(coordinate)));
+}
+}
+
+EventGrid::EventGrid()
+    : _cellSize(0.f)
+    , _invCellSize(0.f)
+    , _valuesVersion(0)
+{
+}
+
+EventGrid::~EventGrid()
+{
+}
+
+void EventGrid::build(const EventSource& source, const float cellSize)
+{
+    build(*source.getGeometry(), source.getValues(), cellSize);
+    _geometry = source.getGeometry();
+    _valuesVersion = source.getValuesVersion();
+}
+
+void EventGrid::build(const EventGeometry& geometry, const float* values,
+                      float cellSize)
+{
+    _geometry.reset();
+    const size_t numEvents = geometry.getNumEvents();
+    if (numEvents == 0)
+    {
+        clear();
+        return;
+    }
+
+    const float* posx = geometry.getPositionsX();
+    const float* posy = geometry.getPositionsY();
+    const float* posz = geometry.getPositionsZ();
+
+    // the bounding box of the source might be preset to a larger area (or
+    // merged over several updates), use the tight box of the current events
+    AABBf bbox;
+    for (size_t i = 0; i < numEvents; ++i)
+        bbox.merge(Vector3f(posx[i], posy[i], posz[i]));
+
+    const Vector3f& extent = bbox.getSize();
+    if (!(cellSize > 0.f))
+        cellSize = std::max(extent.find_max(), 1.f);
+
+    while (true)
+    {
+        for (size_t i = 0; i < 3; ++i)
+            _numCells[i] = size_t(extent[i] / cellSize) + 1;
+
+        const float numCells = float(_numCells[0]) * _numCells[1] *
+                               _numCells[2];
+        if (numCells <= _maxCells)
+            break;
+        cellSize *= std::max(1.01f, std::cbrt(numCells / _maxCells));
+    }
+
+    _origin = bbox.getMin();
+    _cellSize = cellSize;
+    _invCellSize = 1.f / cellSize;
+
+    // counting sort of the events by cell index
+    const size_t numCells = _numCells[0] * _numCells[1] * _numCells[2];
+    std::vector<uint32_t> cells(numEvents);
+    _cellStart.assign(numCells + 1, 0);
+    for (size_t i = 0; i < numEvents; ++i)
+    {
+        const size_t x = std::min<size_t>(
+            (posx[i] - _origin[0]) * _invCellSize, _numCells[0] - 1);
+        const size_t y = std::min<size_t>(
+            (posy[i] - _origin[1]) * _invCellSize, _numCells[1] - 1);
+        const size_t z = std::min<size_t>(
+            (posz[i] - _origin[2]) * _invCellSize, _numCells[2] - 1);
+        cells[i] = x + _numCells[0] * (y + _numCells[1] * z);
+        ++_cellStart[cells[i] + 1];
+    }
+
+    for (size_t i = 0; i < numCells; ++i)
+        _cellStart[i + 1] += _cellStart[i];
+
+    _posX.resize(numEvents);
+    _posY.resize(numEvents);
+    _posZ.resize(numEvents);
+    _radii.resize(numEvents);
+    _values.resize(values ? numEvents : 0);
+    _ids.resize(numEvents);
+
+    const float* radii = geometry.getRadii();
+    std::vector<size_t> next(_cellStart.begin(), _cellStart.end() - 1);
+    for (size_t i = 0; i < numEvents; ++i)
+    {
+        const size_t j = next[cells[i]]++;
+        _posX[j] = posx[i];
+        _posY[j] = posy[i];
+        _posZ[j] = posz[i];
+        _radii[j] = radii[i];
+        _ids[j] = i;
+        if (values)
+            _values[j] = values[i];
+    }
+
+    LBDEBUG << "Binned " << numEvents << " events into " << _numCells
+            << " cells of " << _cellSize << " um" << std::endl;
+}
+
+void EventGrid::clear()
+{
+    _numCells = Vector3ui();
+    _cellSize = 0.f;
+    _invCellSize = 0.f;
+    std::vector<size_t>().swap(_cellStart);
+    std::vector<float>().swap(_posX);
+    std::vector<float>().swap(_posY);
+    std::vector<float>().swap(_posZ);
+    std::vector<float>().swap(_radii);
+    std::vector<float>().swap(_values);
+    std::vector<uint32_t>().swap(_ids);
+    _geometry.reset();
+}
+
+bool EventGrid::isCurrent(const EventSource& source) const
+{
+    // owner_before() does not touch the reference counts, and the weak
+    // reference keeps a freed geometry from matching a new one at its address
+    const ConstEventGeometryPtr& geometry = source.getGeometry();
+    return !_geometry.owner_before(geometry) &&
+           !geometry.owner_before(_geometry) &&
+           _valuesVersion == source.getValuesVersion();
+}
+
+bool EventGrid::getCells(const AABBf& area, Vector3ui& begin,
+                         Vector3ui& end) const
+{
+    if (_ids.empty())
+        return false;
+
+    for (size_t i = 0; i < 3; ++i)
+    {
+        begin[i] = _toCell((area.getMin()[i] - _origin[i]) * _invCellSize,
+                           _numCells[i]);
+        end[i] = _toCell((area.getMax()[i] - _origin[i]) * _invCellSize + 1.f,
+                         _numCells[i]);
+        if (begin[i] >= end[i])
+            return false;
+    }
+    return true;
+}
+}
@@ -0,0 +1,142 @@
+/* Copyright (c) 2017, EPFL/Blue Brain Project
+ *
+ * This file is part of Fivox <https://github.com/BlueBrain/Fivox>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef FIVOX_EVENTGRID_H
+#define FIVOX_EVENTGRID_H
+
+#include <fivox/api.h>
+#include <fivox/types.h>
+
+namespace fivox
+{
+/**
+ * Uniform grid of cubic cells over the events of an EventSource.
+ *
+ * The event attributes are copied in cell order, with cells enumerated along
+ * X first, then Y, then Z. All events of consecutive cells along X are
+ * therefore contiguous in memory, and the events of any box of cells can be
+ * visited with one contiguous range per (Y, Z) row of cells.
+ */
+class EventGrid
+{
+public:
+    FIVOX_API EventGrid();
+    FIVOX_API ~EventGrid();
+
+    /**
+     * (Re)build the grid with the current events of the given source, and
+     * remember their geometry and values for isCurrent().
+     *
+     * @param source the event source to bin.
+     * @param cellSize the minimum edge length of the cells. The actual size
+     *        may be larger to bound the memory used by the cell table.
+     */
+    FIVOX_API void build(const EventSource& source, float cellSize);
+
+    /**
+     * (Re)build the grid over the given events.
+     *
+     * @param geometry the events to bin.
+     * @param values the event values to copy, nullptr to only index the
+     *        events with getEventIds().
+     * @param cellSize see above.
+     */
+    FIVOX_API void build(const EventGeometry& geometry, const float* values,
+                         float cellSize);
+
+    /** Release all memory, getNumEvents() returns 0 afterwards. */
+    FIVOX_API void clear();
+
+    /**
+     * @return true if the grid was built from the given source and its
+     *         geometry and values did not change since.
+     */
+    FIVOX_API bool isCurrent(const EventSource& source) const;
+
+    /**
+     * @return the memory used by build() per event for its attributes, value,
+     *         index and cell, besides the cell table.
+     */
+    static size_t getMemoryPerEvent()
+    {
+        return 5 * sizeof(float) + 2 * sizeof(uint32_t);
+    }
+
+    /** @return the number of binned events. */
+    size_t getNumEvents() const { return _ids.size(); }
+    /** @return the actual edge length of the cells. */
+    float getCellSize() const { return _cellSize; }
+    /** @return the number of cells along each dimension. */
+    const Vector3ui& getNumCells() const { return _numCells; }
+    /** @name Event attributes in cell order, see EventSource getters. */
+    //@{
+    const float* getPositionsX() const { return _posX.data(); }
+    const float* getPositionsY() const { return _posY.data(); }
+    const float* getPositionsZ() const { return _posZ.data(); }
+    const float* getRadii() const { return _radii.data(); }
+    /** @return the event values, nullptr if not copied by build(). */
+    const float* getValues() const
+    {
+        return _values.empty() ? nullptr : _values.data();
+    }
+    /** @return the index of each event in the source. */
+    const uint32_t* getEventIds() const { return _ids.data(); }
+    //@}
+
+    /**
+     * Compute the cells overlapping the given box.
+     *
+     * @param area the query box.
+     * @param begin first cell index on each dimension.
+     * @param end one past the last cell index on each dimension.
+     * @return false if the box does not overlap any cell.
+     */
+    FIVOX_API bool getCells(const AABBf& area, Vector3ui& begin,
+                            Vector3ui& end) const;
+
+    /**
+     * @return the index of the first event in the given cell. The index
+     *         for x equal to getNumCells().x() is the end of the row of cells.
+     */
+    size_t getEventIndex(const size_t x, const size_t y, const size_t z) const
+    {
+        return _cellStart[x + _numCells[0] * (y + _numCells[1] * z)];
+    }
+
+private:
+    Vector3f _origin;
+    float _cellSize;
+    float _invCellSize;
+    Vector3ui _numCells;
+
+    // the source of build(), compared by owner to detect new geometries
+    std::weak_ptr<const EventGeometry> _geometry;
+    uint64_t _valuesVersion;
+
+    // prefix sum of the event counts per cell, with one trailing element
+    std::vector<size_t> _cellStart;
+    std::vector<float> _posX;
+    std::vector<float> _posY;
+    std::vector<float> _posZ;
+    std::vector<float> _radii;
+    std::vector<float> _values;
+    std::vector<uint32_t> _ids;
+};
+}
+
+#endif
@@ -0,0 +1,263 @@
+/* Copyright (c) 2017, EPFL/Blue Brain Project
+ *
+ * This file is part of Fivox <https://github.com/BlueBrain/Fivox>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "eventOctree.h"
+#include "eventSource.h"
+#include "kernels.h"
+
+#include <lunchbox/log.h>
+
+#include <cmath>
+#include <limits>
+
+namespace fivox
+{
+namespace
+{
+// bounds the depth for coincident events, and the traversal stack
+const size_t _maxDepth = 24;
+}
+
+EventOctree::EventOctree()
+    : _valuesVersion(0)
+{
+}
+
+EventOctree::~EventOctree()
+{
+}
+
+void EventOctree::build(const EventSource& source, const size_t leafSize)
+{
+    clear();
+    _geometry = source.getGeometry();
+    _valuesVersion = source.getValuesVersion();
+    const size_t numEvents = source.getNumEvents();
+    if (numEvents == 0)
+        return;
+
+    // the radii are inverted by the source, the tree stores them as given
+    _posX.assign(source.getPositionsX(), source.getPositionsX() + numEvents);
+    _posY.assign(source.getPositionsY(), source.getPositionsY() + numEvents);
+    _posZ.assign(source.getPositionsZ(), source.getPositionsZ() + numEvents);
+    _radii.assign(source.getRadii(), source.getRadii() + numEvents);
+    _values.assign(source.getValues(), source.getValues() + numEvents);
+
+    std::vector<uint32_t> order(numEvents);
+    for (size_t i = 0; i < numEvents; ++i)
+        order[i] = i;
+
+    Node root;
+    root.begin = 0;
+    root.end = numEvents;
+    _nodes.push_back(root);
+    _build(0, order.data(), std::max(leafSize, size_t(1)), 0);
+
+    // copy the events in tree order
+    const auto reorder = [&order](std::vector<float>& data) {
+        std::vector<float> sorted(data.size());
+        for (size_t i = 0; i < data.size(); ++i)
+            sorted[i] = data[order[i]];
+        data.swap(sorted);
+    };
+    reorder(_posX);
+    reorder(_posY);
+    reorder(_posZ);
+    reorder(_radii);
+    reorder(_values);
+
+    LBDEBUG << "Sorted " << numEvents << " events into " << _nodes.size()
+            << " octree nodes" << std::endl;
+}
+
+void EventOctree::clear()
+{
+    std::vector<Node>().swap(_nodes);
+    std::vector<float>().swap(_posX);
+    std::vector<float>().swap(_posY);
+    std::vector<float>().swap(_posZ);
+    std::vector<float>().swap(_radii);
+    std::vector<float>().swap(_values);
+    _geometry.reset();
+}
+
+bool EventOctree::isCurrent(const EventSource& source) const
+{
+    // see EventGrid::isCurrent()
+    const ConstEventGeometryPtr& geometry = source.getGeometry();
+    return !_geometry.owner_before(geometry) &&
+           !geometry.owner_before(_geometry) &&
+           _valuesVersion == source.getValuesVersion();
+}
+
+void EventOctree::_build(const size_t index, uint32_t* order,
+                         const size_t leafSize, const size_t depth)
+{
+    const uint32_t begin = _nodes[index].begin;
+    const uint32_t end = _nodes[index].end;
+
+    // bounding box and moments of the events of the node
+    AABBf bbox;
+    Vector3f centroid(0.f);
+    float charge = 0.f;
+    float weight = 0.f;
+    float minInvRadius = std::numeric_limits<float>::max();
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        const uint32_t event = order[i];
+        const Vector3f position(_posX[event], _posY[event], _posZ[event]);
+        const float value = _values[event];
+        bbox.merge(position);
+        centroid += position * std::abs(value);
+        charge += value;
+        weight += std::abs(value);
+        minInvRadius = std::min(minInvRadius, _radii[event]);
+    }
+    centroid = weight > 0.f ? centroid / weight : bbox.getCenter();
+
+    Vector3f dipole(0.f);
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        const uint32_t event = order[i];
+        const Vector3f position(_posX[event], _posY[event], _posZ[event]);
+        dipole += (position - centroid) * _values[event];
+    }
+
+    Node& node = _nodes[index];
+    node.lower = bbox.getMin();
+    node.upper = bbox.getMax();
+    node.centroid = centroid;
+    node.dipole = dipole;
+    node.charge = charge;
+    node.maxRadius = 1.f / minInvRadius;
+    node.firstChild = 0;
+    node.numChildren = 0;
+
+    if (end - begin <= leafSize || depth >= _maxDepth)
+        return;
+
+    // counting sort of the events into the octants of the box
+    const Vector3f center = bbox.getCenter();
+    const auto getOctant = [&](const uint32_t event) {
+        return (_posX[event] > center[0] ? 1 : 0) |
+               (_posY[event] > center[1] ? 2 : 0) |
+               (_posZ[event] > center[2] ? 4 : 0);
+    };
+
+    uint32_t counts[8] = {0};
+    for (uint32_t i = begin; i < end; ++i)
+        ++counts[getOctant(order[i])];
+
+    uint32_t starts[9] = {begin};
+    for (size_t i = 0; i < 8; ++i)
+        starts[i + 1] = starts[i] + counts[i];
+
+    const std::vector<uint32_t> events(order + begin, order + end);
+    uint32_t next[8];
+    std::copy(starts, starts + 8, next);
+    for (const uint32_t event : events)
+        order[next[getOctant(event)]++] = event;
+
+    // the children of a node are contiguous, empty octants are skipped
+    const uint32_t firstChild = _nodes.size();
+    for (size_t i = 0; i < 8; ++i)
+    {
+        if (counts[i] == 0)
+            continue;
+        Node child;
+        child.begin = starts[i];
+        child.end = starts[i + 1];
+        _nodes.push_back(child);
+    }
+    _nodes[index].firstChild = firstChild;
+    _nodes[index].numChildren = _nodes.size() - firstChild;
+
+    const uint32_t numChildren = _nodes[index].numChildren;
+    for (uint32_t i = 0; i < numChildren; ++i)
+        _build(firstChild + i, order, leafSize, depth + 1);
+}
+
+float EventOctree::sampleField(const Vector3f& point,
+                               const float cutOffDistance,
+                               const float theta) const
+{
+    if (_nodes.empty())
+        return 0.f;
+
+    const float cutOffDistance2 = cutOffDistance * cutOffDistance;
+    const float theta2 = theta * theta;
+
+    // each level pushes at most 8 children
+    uint32_t stack[8 * _maxDepth + 1];
+    size_t stackSize = 0;
+    stack[stackSize++] = 0;
+
+    float voltage = 0.f;
+    while (stackSize > 0)
+    {
+        const Node& node = _nodes[stack[--stackSize]];
+
+        // closest and farthest distance from the point to the events
+        float minDistance2 = 0.f;
+        float maxDistance2 = 0.f;
+        for (size_t i = 0; i < 3; ++i)
+        {
+            const float toLower = node.lower[i] - point[i];
+            const float toUpper = point[i] - node.upper[i];
+            const float outside = std::max(0.f, std::max(toLower, toUpper));
+            const float farthest =
+                std::max(std::abs(toLower), std::abs(toUpper));
+            minDistance2 += outside * outside;
+            maxDistance2 += farthest * farthest;
+        }
+
+        if (minDistance2 > cutOffDistance2)
+            continue;
+
+        if (maxDistance2 <= cutOffDistance2 &&
+            minDistance2 >= node.maxRadius * node.maxRadius)
+        {
+            // expansion of value / |point - position|^2 around the centroid
+            const Vector3f distance = point - node.centroid;
+            const float distance2 = distance.squared_length();
+            const float size = (node.upper - node.lower).find_max();
+            if (size * size < theta2 * distance2)
+            {
+                const float invDistance2 = 1.f / distance2;
+                voltage += invDistance2 *
+                           (node.charge + 2.f * invDistance2 *
+                                              distance.dot(node.dipole));
+                continue;
+            }
+        }
+
+        if (node.numChildren == 0)
+        {
+            voltage += kernels::sampleField(_posX.data(), _posY.data(),
+                                            _posZ.data(), _radii.data(),
+                                            _values.data(), node.begin,
+                                            node.end, point, cutOffDistance);
+            continue;
+        }
+
+        for (uint32_t i = 0; i < node.numChildren; ++i)
+            stack[stackSize++] = node.firstChild + i;
+    }
+    return voltage;
+}
+}
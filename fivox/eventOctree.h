@@ -0,0 +1,106 @@
+/* Copyright (c) 2017, EPFL/Blue Brain Project
+ *
+ * This file is part of Fivox <https://github.com/BlueBrain/Fivox>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef FIVOX_EVENTOCTREE_H
+#define FIVOX_EVENTOCTREE_H
+
+#include <fivox/api.h>
+#include <fivox/types.h>
+
+namespace fivox
+{
+/**
+ * Octree over the events of an EventSource with the multipole moments of
+ * their values, to approximate the field of distant events (Barnes-Hut).
+ *
+ * The event attributes are copied in tree order, so the events of each node
+ * are contiguous in memory.
+ */
+class EventOctree
+{
+public:
+    FIVOX_API EventOctree();
+    FIVOX_API ~EventOctree();
+
+    /**
+     * (Re)build the tree with the current events of the given source, and
+     * remember their geometry and values for isCurrent().
+     *
+     * @param source the event source to sort.
+     * @param leafSize the maximum number of events in a leaf node.
+     */
+    FIVOX_API void build(const EventSource& source, size_t leafSize = 64);
+
+    /** Release all memory, getNumEvents() returns 0 afterwards. */
+    FIVOX_API void clear();
+
+    /**
+     * @return true if the tree was built from the given source and its
+     *         geometry and values did not change since.
+     */
+    FIVOX_API bool isCurrent(const EventSource& source) const;
+
+    /** @return the number of sorted events. */
+    size_t getNumEvents() const { return _values.size(); }
+    /** @return the number of nodes of the tree. */
+    size_t getNumNodes() const { return _nodes.size(); }
+    /**
+     * Sample the field of the events at the given point, see
+     * kernels::sampleField().
+     *
+     * The events of a node are replaced by the monopole and dipole moments of
+     * their values if the node is seen under an angle smaller than theta,
+     * i.e. if its size is smaller than theta times its distance to the point,
+     * and if all events of the node are within the cutoff distance and
+     * outside of their radius. The error decreases with theta, which gives
+     * the exact field for 0.
+     */
+    FIVOX_API float sampleField(const Vector3f& point, float cutOffDistance,
+                                float theta) const;
+
+private:
+    struct Node
+    {
+        Vector3f lower; // tight bounding box of the events
+        Vector3f upper;
+        Vector3f centroid; // expansion center, |value| weighted
+        Vector3f dipole;   // sum of value * (position - centroid)
+        float charge;      // sum of values
+        float maxRadius;   // largest event radius
+        uint32_t begin;    // events of the node
+        uint32_t end;
+        uint32_t firstChild; // children are contiguous, none for leaves
+        uint32_t numChildren;
+    };
+
+    // the source of build(), compared by owner to detect new geometries
+    std::weak_ptr<const EventGeometry> _geometry;
+    uint64_t _valuesVersion;
+
+    std::vector<Node> _nodes;
+    std::vector<float> _posX;
+    std::vector<float> _posY;
+    std::vector<float> _posZ;
+    std::vector<float> _radii;
+    std::vector<float> _values;
+
+    void _build(size_t index, uint32_t* order, size_t leafSize, size_t depth);
+};
+}
+
+#endif
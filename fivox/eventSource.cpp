@@ -20,44 +20,221 @@
  */
 
 #include "eventSource.h"
+#include "eventGeometry.h"
+#include "eventGrid.h"
+#include "kernels.h"
 #include "uriHandler.h"
+#include "valueCache.h"
 #include <fivox/version.h>
 
-#include <lunchbox/atomic.h>
 #include <lunchbox/debug.h>
 #include <lunchbox/log.h>
 #include <lunchbox/memoryMap.h>
 
+#include <atomic>
+#include <cmath>
+#include <cstring>
 #include <fstream>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <thread>
 
-#ifdef USE_BOOST_GEOMETRY
-#include <boost/geometry.hpp>
-#include <boost/geometry/geometries/box.hpp>
-#include <boost/geometry/geometries/point.hpp>
-#include <boost/geometry/index/rtree.hpp>
-#include <lunchbox/scopedMutex.h>
-
-namespace bg = boost::geometry;
-namespace bgi = boost::geometry::index;
-
-typedef bg::model::point<float, 3, bg::cs::cartesian> Point;
-typedef bg::model::box<Point> Box;
-typedef std::pair<Point, size_t> Value;
-typedef std::vector<Value> Values;
-
-#endif
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace
 {
-const size_t maxElemInNode = 64;
-const size_t minElemInNode = 16;
 const uint32_t magic = 0xfebf;
 const uint32_t version = 1;
+const uint32_t mappedVersion = 2;
+const size_t _columnAlignment = 64;
 
 size_t _getBinarySize(const size_t numEvents)
 {
     return numEvents * 5 * sizeof(float) + sizeof(magic) + sizeof(version);
 }
+
+// flags of the binary format version 2, 0 for the inverted radii of the
+// first files without them
+const uint32_t _plainRadii = 1 << 0;
+const uint32_t _hasChecksums = 1 << 1;
+
+/**
+ * Header of the binary format version 2, followed by one column per event
+ * attribute: positions along X, Y and Z, radii and values. The columns are
+ * aligned to 64 bytes, so they can be used in place.
+ */
+struct MappedHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t numEvents;
+    float boundingBox[6]; // min and max of the positions
+    uint64_t columnSize;  // in bytes, including the padding
+    float cutOffDistance; // of the source which wrote the file, or 0
+    uint32_t flags;
+    uint64_t checksums[5]; // of the columns without padding, if _hasChecksums
+    uint8_t reserved[32];  // 0, for future use
+};
+static_assert(sizeof(MappedHeader) % _columnAlignment == 0,
+              "Columns must stay aligned after the header");
+
+// the event sources keep inverted radii, the ASCII and version 1 files
+// store the radii
+float _invert(const float radius)
+{
+    return std::abs(radius) > std::numeric_limits<float>::epsilon()
+               ? 1.f / radius
+               : 0.f;
+}
+
+size_t _getColumnSize(const size_t numEvents)
+{
+    return (numEvents * sizeof(float) + _columnAlignment - 1) /
+           _columnAlignment * _columnAlignment;
+}
+
+// the URI parameters which determine the values of a frame source
+std::string _getValueParameters(const fivox::URIHandler& params)
+{
+    std::ostringstream parameters;
+    parameters << int(params.getType()) << ":" << params.getConfigPath() << ":"
+               << params.getReport() << ":" << params.getAreas();
+    return parameters.str();
+}
+
+// ASCII files smaller than this are parsed by one thread
+const size_t _minAsciiChunkSize = 1 << 20;
+// events parsed before they are copied to the source
+const size_t _asciiBatchSize = 1024;
+
+const char* _findLineEnd(const char* ptr, const char* end)
+{
+    const void* lineEnd = ::memchr(ptr, '\n', end - ptr);
+    return lineEnd ? static_cast<const char*>(lineEnd) : end;
+}
+
+const char* _skipBlanks(const char* ptr, const char* end)
+{
+    while (ptr < end && (*ptr == ' ' || *ptr == '\t' || *ptr == '\r'))
+        ++ptr;
+    return ptr;
+}
+
+// false for empty lines and comments
+bool _hasContent(const char* ptr, const char* lineEnd)
+{
+    ptr = _skipBlanks(ptr, lineEnd);
+    return ptr < lineEnd && *ptr != '#';
+}
+
+/**
+ * Parse a decimal number with digits up to 2^24 and a power of ten up to 10,
+ * e.g. as written by Fivox, without strtof(). Both the digits and the power
+ * are exact in float, so the single multiplication or division rounds like
+ * strtof() (Clinger's fast path).
+ *
+ * @return the end of the number, or nullptr to fall back to strtof().
+ */
+const char* _parseFloat(const char* ptr, const char* end, float& value)
+{
+    static const float powers[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f,
+                                   1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+    const uint32_t maxMantissa = 1 << 24;
+    const bool negative = ptr < end && *ptr == '-';
+    if (ptr < end && (*ptr == '-' || *ptr == '+'))
+        ++ptr;
+
+    uint32_t mantissa = 0;
+    int exponent = 0;
+    bool hasDigits = false;
+    for (; ptr < end && *ptr >= '0' && *ptr <= '9'; ++ptr, hasDigits = true)
+    {
+        mantissa = mantissa * 10 + (*ptr - '0');
+        if (mantissa > maxMantissa)
+            return nullptr;
+    }
+    if (ptr < end && *ptr == '.')
+    {
+        for (++ptr; ptr < end && *ptr >= '0' && *ptr <= '9';
+             ++ptr, hasDigits = true)
+        {
+            mantissa = mantissa * 10 + (*ptr - '0');
+            if (mantissa > maxMantissa)
+                return nullptr;
+            --exponent;
+        }
+    }
+    if (!hasDigits)
+        return nullptr;
+
+    if (ptr < end && (*ptr == 'e' || *ptr == 'E'))
+    {
+        ++ptr;
+        const bool negativeExponent = ptr < end && *ptr == '-';
+        if (ptr < end && (*ptr == '-' || *ptr == '+'))
+            ++ptr;
+        if (ptr == end || *ptr < '0' || *ptr > '9')
+            return nullptr;
+        int power = 0;
+        for (; ptr < end && *ptr >= '0' && *ptr <= '9' && power < 100; ++ptr)
+            power = power * 10 + (*ptr - '0');
+        exponent += negativeExponent ? -power : power;
+    }
+    if (exponent < -10 || exponent > 10)
+        return nullptr;
+
+    value = exponent < 0 ? float(mantissa) / powers[-exponent]
+                         : float(mantissa) * powers[exponent];
+    if (negative)
+        value = -value;
+    return ptr;
+}
+
+/**
+ * Parse the five values of an event line, each followed by a blank or by the
+ * end of the line. The line is followed by a newline or by a null-terminated
+ * copy, so strtof() stops within the line.
+ */
+bool _parseEvent(const char* ptr, const char* lineEnd, float* event)
+{
+    for (size_t i = 0; i < 5; ++i)
+    {
+        ptr = _skipBlanks(ptr, lineEnd);
+        if (ptr == lineEnd)
+            return false;
+
+        const char* next = _parseFloat(ptr, lineEnd, event[i]);
+        if (!next)
+        {
+            char* parsed;
+            event[i] = std::strtof(ptr, &parsed);
+            next = parsed;
+            if (next == ptr || next > lineEnd)
+                return false;
+        }
+        // reject numbers run together, e.g. "1-2" or "1.5.3"
+        if (_skipBlanks(next, lineEnd) == next && next != lineEnd)
+            return false;
+        ptr = next;
+    }
+    return _skipBlanks(ptr, lineEnd) == lineEnd;
+}
+
+/** Run task(i) for i in [0, numTasks) with one thread per task. */
+template <typename F>
+void _parallelFor(const size_t numTasks, const F& task)
+{
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < numTasks; ++i)
+        threads.emplace_back(task, i);
+    task(0);
+    for (auto& thread : threads)
+        thread.join();
+}
 }
 
 namespace fivox
@@ -65,100 +242,447 @@ namespace fivox
 class EventSource::Impl
 {
 public:
-    enum EventOffsets
-    {
-        POSX = 0,
-        POSY,
-        POSZ,
-        RADIUS,
-        VALUE,
-        NUM_OFFSETS
-    };
-
     explicit Impl(const URIHandler& params)
         : dt(params.getDt())
         , duration(params.getDuration())
         , currentTime(-1.)
+        , frameWindow(0, 0)
         , cutOffDistance(params.getCutoffDistance())
-        , alignBoundary(32)
+        , geometry(std::make_shared<EventGeometry>())
+        , isShared(false)
+        , values(nullptr)
         , numEvents(0)
-        , allocSize(0)
+        , mapped(false)
+        , valuesReadOnly(false)
+        , valuesVersion(0)
+        , geometryVersion(0)
+        , allValues(nullptr)
+        , allNumEvents(0)
+        , valueCacheFilename(params.getValueCacheFilename())
+        , valueParameters(valueCacheFilename.empty()
+                              ? std::string()
+                              : _getValueParameters(params))
+        , quantizeValueCache(params.getValueCacheBits() == 16)
     {
     }
 
-    void resize(const size_t numEvents_)
+    void resetValues(const size_t numEvents_)
     {
+        valueStorage.assign(numEvents_, 0.f);
+        values = valueStorage.data();
+        ++valuesVersion;
         numEvents = numEvents_;
-        if (numEvents_ < allocSize)
-            return;
+        valuesOwner.reset();
+        valuesReadOnly = false;
+        valueCache.close();
+        releaseSelection();
+    }
 
-        allocSize = numEvents_;
-        const size_t size = numEvents * EventOffsets::NUM_OFFSETS;
-        void* ptr;
-        if (posix_memalign(&ptr, alignBoundary, size * sizeof(float)))
+    void releaseSelection()
+    {
+        allGeometry.reset();
+        std::vector<float>().swap(allValueStorage);
+        allValuesOwner.reset();
+        allValues = nullptr;
+        allNumEvents = 0;
+    }
+
+    void selectEvents(const size_t first, const size_t count)
+    {
+        if (!allGeometry)
         {
-            LBWARN << "Memory alignment failed. "
-                   << "Trying normal allocation" << std::endl;
-            ptr = calloc(size, sizeof(float));
-            if (!ptr)
-                LBTHROW(std::bad_alloc());
+            allGeometry = geometry;
+            allValueStorage.swap(valueStorage); // keeps values valid
+            allValuesOwner = valuesOwner;
+            allValues = values;
+            allNumEvents = numEvents;
         }
-        events.reset((float*)ptr);
+        if (first > allNumEvents || count > allNumEvents - first)
+            LBTHROW(std::out_of_range("EventSource::selectEvents: Out of "
+                                      "range"));
+
+        const float* posx = allGeometry->getPositionsX() + first;
+        const float* posy = allGeometry->getPositionsY() + first;
+        const float* posz = allGeometry->getPositionsZ() + first;
+        AABBf bbox;
+        for (size_t i = 0; i < count; ++i)
+            bbox.merge(Vector3f(posx[i], posy[i], posz[i]));
+
+        geometry = std::make_shared<EventGeometry>(
+            count, posx, posy, posz, allGeometry->getRadii() + first, bbox,
+            allGeometry);
+        isShared = true;
+        valueStorage.assign(allValues + first, allValues + first + count);
+        values = valueStorage.data();
+        ++valuesVersion;
+        numEvents = count;
+        valuesReadOnly = false;
+        valueCache.close();
     }
 
-    bool readAscii(const std::string& filename)
+    /** Copy read-only values before writing them. */
+    float* editValues()
+    {
+        if (valuesReadOnly)
+        {
+            valueStorage.assign(values, values + numEvents);
+            values = valueStorage.data();
+            valuesOwner.reset();
+            valuesReadOnly = false;
+        }
+        return values;
+    }
+
+    void adoptValues(const float* values_, std::shared_ptr<const void> owner)
     {
-        std::string line;
-        std::ifstream file(filename);
+        values = const_cast<float*>(values_);
+        ++valuesVersion;
+        valuesOwner = owner;
+        valuesReadOnly = true;
+        std::vector<float>().swap(valueStorage);
+    }
 
-        if (!file.is_open())
+    /**
+     * Set the values of the given frame from the value cache, opening it
+     * first if needed.
+     *
+     * @return false if the frame is not cached.
+     */
+    bool readCachedValues(const EventSource& source, const uint32_t frame)
+    {
+        if (!valueCache.isOpen() &&
+            !valueCache.open(valueCacheFilename,
+                             ValueCache::computeHash(
+                                 source, valueParameters + ":" +
+                                             source._getValueOptions()),
+                             numEvents, source.getFrameRange(),
+                             quantizeValueCache))
+        {
+            valueCacheFilename.clear(); // do not retry on each frame
             return false;
+        }
 
-        size_t index = 0;
-        while (std::getline(file, line))
+        // unquantized values are used in place, the mapping is read-only
+        const float* cached = valueCache.getValues(frame);
+        if (cached)
         {
-            if (line[0] == '#' || line[0] == '\n')
-                continue;
+            values = const_cast<float*>(cached);
+            ++valuesVersion;
+            valuesReadOnly = true;
+            return true;
+        }
+        return valueCache.hasFrame(frame) &&
+               valueCache.read(frame, editValues());
+    }
+
+    void resize(const size_t numEvents_)
+    {
+        geometry = std::make_shared<EventGeometry>(numEvents_);
+        isShared = false;
+        resetValues(numEvents_);
+    }
+
+    void setGeometry(ConstEventGeometryPtr geometry_)
+    {
+        geometry = geometry_;
+        isShared = true;
+        resetValues(geometry->getNumEvents());
+        boundingBox.merge(geometry->getBoundingBox());
+    }
+
+    /** Copy the geometry on the first update after it was shared. */
+    EventGeometry& editGeometry()
+    {
+        if (isShared || geometry.use_count() > 1)
+        {
+            geometry = std::make_shared<EventGeometry>(*geometry);
+            isShared = false;
+        }
+        ++geometryVersion;
+        // created as a non-const object by resize() or above
+        return const_cast<EventGeometry&>(*geometry);
+    }
 
-            if (line.find("Number of events: ") != std::string::npos)
+    /** Line-aligned part of an ASCII event file, parsed by one thread. */
+    struct AsciiChunk
+    {
+        const char* begin;
+        const char* end;
+        size_t firstLine;  // 1-based line number of begin
+        size_t firstEvent; // index of the first event
+        size_t numLines;
+        size_t numEvents;
+        size_t errorLine; // of the first ill-formed line, 0 if none
+    };
+
+    bool readAscii(const std::string& filename)
+    {
+        lunchbox::MemoryMap file(filename);
+        const char* ptr = file.getAddress<char>();
+        if (!ptr)
+            return false;
+        const char* const end = ptr + file.getSize();
+
+        // header with comments and the number of events, up to the first
+        // event
+        const std::string countTag = "Number of events: ";
+        size_t numEvents_ = 0;
+        size_t lineNumber = 1;
+        for (; ptr < end; ++lineNumber)
+        {
+            const char* lineEnd = _findLineEnd(ptr, end);
+            const std::string line(ptr, lineEnd);
+            if (line.find(countTag) != std::string::npos)
             {
                 const auto pos = line.find_last_of(" \t");
-                resize(atoi(line.substr(pos + 1).c_str()));
+                numEvents_ = std::strtoull(line.c_str() + pos + 1, nullptr, 10);
+            }
+            else if (_hasContent(ptr, lineEnd))
+                break;
+            ptr = std::min(lineEnd + 1, end);
+        }
+
+        if (numEvents_ == 0)
+        {
+            LBWARN << "No events to load. Please check that the number "
+                      "of events in the specified file is > 0"
+                   << std::endl;
+            return false;
+        }
+        resize(numEvents_);
+
+        // line-aligned chunks, counted first to get the index of their
+        // first event, then parsed in parallel into their events
+        const size_t numChunks = std::max<size_t>(
+            1, std::min<size_t>(std::thread::hardware_concurrency(),
+                                (end - ptr) / _minAsciiChunkSize));
+        std::vector<AsciiChunk> chunks(numChunks);
+        for (size_t i = 0; i < numChunks; ++i)
+        {
+            chunks[i].begin = i == 0 ? ptr : chunks[i - 1].end;
+            chunks[i].end = i + 1 == numChunks
+                                ? end
+                                : ptr + (end - ptr) * (i + 1) / numChunks;
+            if (chunks[i].end < chunks[i].begin)
+                chunks[i].end = chunks[i].begin;
+            else if (chunks[i].end < end)
+                chunks[i].end =
+                    std::min(_findLineEnd(chunks[i].end, end) + 1, end);
+        }
+
+        _parallelFor(numChunks, [&chunks](const size_t i) {
+            AsciiChunk& chunk = chunks[i];
+            chunk.numLines = 0;
+            chunk.numEvents = 0;
+            for (const char* line = chunk.begin; line < chunk.end;
+                 ++chunk.numLines)
+            {
+                const char* lineEnd = _findLineEnd(line, chunk.end);
+                if (_hasContent(line, lineEnd))
+                    ++chunk.numEvents;
+                line = lineEnd + 1;
+            }
+        });
+
+        size_t numRead = 0;
+        for (auto& chunk : chunks)
+        {
+            chunk.firstLine = lineNumber;
+            chunk.firstEvent = numRead;
+            lineNumber += chunk.numLines;
+            numRead += chunk.numEvents;
+        }
+
+        _parallelFor(numChunks, [&](const size_t i) {
+            parseAscii(chunks[i], end);
+        });
+
+        size_t errorLine = 0;
+        for (const auto& chunk : chunks)
+        {
+            if (chunk.errorLine != 0)
+            {
+                errorLine = chunk.errorLine;
+                break;
+            }
+        }
+        if (errorLine != 0)
+        {
+            LBWARN << "Error while reading " << numEvents_ << " events from "
+                   << filename << ": line " << errorLine << " ill-formed"
+                   << std::endl;
+            return false;
+        }
+
+        if (numRead < numEvents_)
+            LBWARN << "Only " << numRead << " of " << numEvents_
+                   << " events found in " << filename << std::endl;
+        LBINFO << "Loaded " << numEvents_ << " events from ASCII file "
+               << filename << std::endl;
+        return true;
+    }
+
+    /** Parse the events of the given chunk, see readAscii(). */
+    void parseAscii(AsciiChunk& chunk, const char* fileEnd)
+    {
+        chunk.errorLine = 0;
+        float events[5][_asciiBatchSize];
+        size_t numBatched = 0;
+        size_t index = chunk.firstEvent;
+        const auto flush = [&] {
+            update(index, numBatched, events[0], events[1], events[2],
+                   events[3], events[4]);
+            index += numBatched;
+            numBatched = 0;
+        };
+
+        size_t lineNumber = chunk.firstLine;
+        for (const char* line = chunk.begin; line < chunk.end; ++lineNumber)
+        {
+            const char* lineEnd = _findLineEnd(line, chunk.end);
+            const char* next = lineEnd + 1;
+            if (!_hasContent(line, lineEnd))
+            {
+                line = next;
                 continue;
             }
 
-            if (numEvents == 0)
+            // the last line may not end with a newline
+            std::string copy;
+            if (lineEnd == fileEnd)
             {
-                LBWARN << "No events to load. Please check that the number "
-                          "of events in the specified file is > 0"
-                       << std::endl;
-                return false;
+                copy.assign(line, lineEnd);
+                line = copy.c_str();
+                lineEnd = line + copy.size();
+            }
+
+            float event[5];
+            if (index + numBatched >= numEvents ||
+                !_parseEvent(line, lineEnd, event))
+            {
+                chunk.errorLine = lineNumber;
+                break;
             }
+            for (size_t j = 0; j < 5; ++j)
+                events[j][numBatched] = event[j];
+            if (++numBatched == _asciiBatchSize)
+                flush();
+            line = next;
+        }
+        flush();
+    }
+
+    bool readMapped(const std::string& filename)
+    {
+        const int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat info;
+        if (::fstat(fd, &info) != 0 ||
+            size_t(info.st_size) < sizeof(MappedHeader))
+        {
+            ::close(fd);
+            return false;
+        }
+
+        // a private mapping copies only the pages of the values which are
+        // modified later, and never writes back to the file
+        const size_t size = info.st_size;
+        void* address = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (address == MAP_FAILED)
+            return false;
+        const std::shared_ptr<void> mapping(address, [size](void* ptr) {
+            ::munmap(ptr, size);
+        });
+
+        const MappedHeader& header = *static_cast<MappedHeader*>(address);
+        if (header.magic != magic || header.version != mappedVersion)
+            return false;
 
-            // split the line in tokens (separated by white spaces)
-            std::vector<float> event;
-            std::string token;
-            std::istringstream iss(line);
-            while (iss >> token)
-                event.push_back(atof(token.c_str()));
+        // the sizes are checked without overflows for corrupt headers
+        const size_t numEvents_ = header.numEvents;
+        const size_t columnSize = header.columnSize;
+        if (header.numEvents >
+                std::numeric_limits<size_t>::max() / sizeof(float) ||
+            header.columnSize > (size - sizeof(MappedHeader)) / 5 ||
+            columnSize < numEvents_ * sizeof(float) ||
+            columnSize % _columnAlignment != 0)
+        {
+            LBWARN << "Error while reading " + std::to_string(numEvents_) +
+                          " events from file " + filename
+                   << std::endl;
+            return false;
+        }
+
+        float* columns[5];
+        for (size_t i = 0; i < 5; ++i)
+            columns[i] = reinterpret_cast<float*>(
+                static_cast<uint8_t*>(address) + sizeof(MappedHeader) +
+                i * columnSize);
 
-            if (event.size() != 5)
+#ifndef NDEBUG
+        // verifying reads the whole file, which the release builds avoid
+        for (size_t i = 0; i < 5 && (header.flags & _hasChecksums); ++i)
+        {
+            if (kernels::hashWords(columns[i], numEvents_) !=
+                header.checksums[i])
             {
-                LBWARN << "Error while reading " + std::to_string(numEvents) +
-                              " events from file: event " +
-                              std::to_string(index) + " ill-formed."
-                       << std::endl;
+                LBWARN << "Checksum mismatch in column " << i << " of "
+                       << filename << std::endl;
                 return false;
             }
+        }
+#endif
 
-            update(index++, Vector3f(event[0], event[1], event[2]), event[3],
-                   event[4]);
+        if (header.cutOffDistance != 0.f &&
+            header.cutOffDistance != cutOffDistance)
+        {
+            LBINFO << "Events of " << filename << " were written for a "
+                   << "cutoff distance of " << header.cutOffDistance
+                   << ", using " << cutOffDistance << std::endl;
         }
-        file.close();
-        LBINFO << "Loaded " << numEvents << " events from ASCII file "
-               << filename << std::endl;
 
-        return file.good();
+        // files written by other tools may hold the radii, which are then
+        // inverted into a copy of their column
+        std::shared_ptr<const void> owner = mapping;
+        if (header.flags & _plainRadii)
+        {
+            std::shared_ptr<std::vector<float>> radii(
+                new std::vector<float>(numEvents_),
+                [mapping](std::vector<float>* ptr) { delete ptr; });
+            for (size_t i = 0; i < numEvents_; ++i)
+                (*radii)[i] = _invert(columns[3][i]);
+            columns[3] = radii->data();
+            owner = radii;
+        }
+
+        const AABBf bbox(Vector3f(header.boundingBox[0],
+                                  header.boundingBox[1],
+                                  header.boundingBox[2]),
+                         Vector3f(header.boundingBox[3],
+                                  header.boundingBox[4],
+                                  header.boundingBox[5]));
+        geometry = std::make_shared<EventGeometry>(numEvents_, columns[0],
+                                                   columns[1], columns[2],
+                                                   columns[3], bbox, owner);
+        isShared = true;
+        valueStorage.clear();
+        values = columns[4];
+        ++valuesVersion;
+        numEvents = numEvents_;
+        mapped = true;
+        valuesOwner = mapping;
+        valuesReadOnly = false;
+        valueCache.close();
+        releaseSelection();
+        boundingBox.merge(bbox);
+
+        LBINFO << "Mapped " << numEvents_ << " events from binary file "
+               << filename << std::endl;
+        return true;
     }
 
     bool isBinary(const lunchbox::MemoryMap& binaryFile) const
@@ -218,95 +742,142 @@ public:
         return true;
     }
 
-    const float* getPositionsX() const
-    {
-        return events.get() + numEvents * EventOffsets::POSX;
-    }
+    size_t getNumEvents() const { return numEvents; }
+    const float* getPositionsX() const { return geometry->getPositionsX(); }
+    const float* getPositionsY() const { return geometry->getPositionsY(); }
+    const float* getPositionsZ() const { return geometry->getPositionsZ(); }
+    const float* getRadii() const { return geometry->getRadii(); }
+    const float* getValues() const { return values; }
 
-    const float* getPositionsY() const
+    void update(const size_t i, const Vector3f& pos, const float rad,
+                const float val)
     {
-        return events.get() + numEvents * EventOffsets::POSY;
-    }
+        if (i >= numEvents)
+        {
+            LBWARN << "The specified index is not valid. Event not added"
+                   << std::endl;
+            return;
+        }
 
-    const float* getPositionsZ() const
-    {
-        return events.get() + numEvents * EventOffsets::POSZ;
+        editGeometry().update(i, pos, rad);
+        boundingBox.merge(pos);
+        editValues()[i] = val;
+        ++valuesVersion;
+        valueCache.close(); // reopened for the new events
     }
 
-    const float* getRadii() const
+    void update(const size_t first, const size_t count, const float* posx,
+                const float* posy, const float* posz, const float* radii,
+                const float* values_)
     {
-        return events.get() + numEvents * EventOffsets::RADIUS;
-    }
+        if (first > numEvents || count > numEvents - first)
+            LBTHROW(std::out_of_range("EventSource::update: Out of range"));
 
-    const float* getValues() const
-    {
-        return events.get() + numEvents * EventOffsets::VALUE;
+        EventGeometry* events;
+        float* eventValues;
+        {
+            // shared geometries and cached values are copied by the first
+            // of concurrent updates
+            std::lock_guard<std::mutex> lock(updateMutex);
+            events = &editGeometry();
+            eventValues = editValues();
+            ++valuesVersion;
+            valueCache.close();
+        }
+
+        const AABBf& bbox =
+            events->update(first, count, posx, posy, posz, radii);
+        if (values_)
+            std::copy(values_, values_ + count, eventValues + first);
+
+        std::lock_guard<std::mutex> lock(updateMutex);
+        boundingBox.merge(bbox);
     }
 
-    void update(const size_t i, const Vector3f& pos, const float rad,
-                const float val)
+    /** Call visitor with the index of each event in the given area. */
+    template <typename F>
+    void visit(const AABBf& area, const F& visitor) const
     {
-        const size_t size(numEvents);
-        if (size <= i)
+        const Vector3f& lower = area.getMin();
+        const Vector3f& upper = area.getMax();
+        const auto isInside = [&](const float x, const float y,
+                                  const float z) {
+            return x >= lower[0] && x <= upper[0] && y >= lower[1] &&
+                   y <= upper[1] && z >= lower[2] && z <= upper[2];
+        };
+
+        if (!geometry->hasIndex())
         {
-            LBWARN << "The specified index is not valid. Event not added"
-                   << std::endl;
+            static std::atomic<bool> warned(false);
+            if (!warned && !warned.exchange(true))
+                LBWARN << "No spatial index for findEvents, call buildIndex() "
+                       << "to avoid testing all events" << std::endl;
+
+            const float* posx = getPositionsX();
+            const float* posy = getPositionsY();
+            const float* posz = getPositionsZ();
+            for (size_t i = 0; i < getNumEvents(); ++i)
+                if (isInside(posx[i], posy[i], posz[i]))
+                    visitor(i);
             return;
         }
 
-        boundingBox.merge(pos);
-        events.get()[i + size * Impl::EventOffsets::POSX] = pos[0];
-        events.get()[i + size * Impl::EventOffsets::POSY] = pos[1];
-        events.get()[i + size * Impl::EventOffsets::POSZ] = pos[2];
-
-        // radius is inverted to improve performance at computing time
-        // e.g. LFP functor
-        if (std::abs(rad) > std::numeric_limits<float>::epsilon()) // rad != 0
-            events.get()[i + size * Impl::EventOffsets::RADIUS] = 1.f / rad;
-
-        events.get()[i + size * Impl::EventOffsets::VALUE] = val;
+        const EventGrid& index = geometry->getIndex();
+        Vector3ui begin, end;
+        if (!index.getCells(area, begin, end))
+            return;
 
-#ifdef USE_BOOST_GEOMETRY
-        rtree.clear();
-#endif
+        const float* posx = index.getPositionsX();
+        const float* posy = index.getPositionsY();
+        const float* posz = index.getPositionsZ();
+        const uint32_t* ids = index.getEventIds();
+        for (size_t z = begin[2]; z < end[2]; ++z)
+        {
+            for (size_t y = begin[1]; y < end[1]; ++y)
+            {
+                const size_t first = index.getEventIndex(begin[0], y, z);
+                const size_t last = index.getEventIndex(end[0], y, z);
+                for (size_t i = first; i < last; ++i)
+                    if (isInside(posx[i], posy[i], posz[i]))
+                        visitor(ids[i]);
+            }
+        }
     }
 
     double dt;
     double duration;
     double currentTime;
+    Vector2ui frameWindow; // from setFrameWindow()
     const float cutOffDistance;
 
-    const size_t alignBoundary;
-    size_t numEvents;
-    size_t allocSize;
-    Events events;
-    AABBf boundingBox;
+    std::mutex updateMutex; // for concurrent range updates
+    ConstEventGeometryPtr geometry;
+    bool isShared; // by setGeometry(), do not modify even if unique
 
-#ifdef USE_BOOST_GEOMETRY
-    typedef bgi::rtree<Value, bgi::rstar<maxElemInNode, minElemInNode>> RTree;
-    RTree rtree;
-
-    void buildRTree()
-    {
-        if (!rtree.empty())
-            return;
-
-        LBINFO << "Building rtree for " << numEvents << " events" << std::endl;
-        Values positions;
-        positions.reserve(numEvents);
-
-        for (size_t i = 0; i < numEvents; i++)
-        {
-            const Point point(getPositionsX()[i], getPositionsY()[i],
-                              getPositionsZ()[i]);
-            positions.push_back(std::make_pair(point, i));
-        }
+    // in valueStorage, the value cache, or the mapping or adopted buffer of
+    // valuesOwner
+    float* values;
+    size_t numEvents;
+    bool mapped; // by the last read(), see isMapped()
+    std::vector<float> valueStorage;
+    std::shared_ptr<const void> valuesOwner;
+    bool valuesReadOnly; // in the value cache or adopted
+    std::atomic<uint64_t> valuesVersion; // see getValuesVersion()
+    uint64_t geometryVersion;            // see getGeometryVersion()
+
+    // all events, while selectEvents() restricts them to a range
+    ConstEventGeometryPtr allGeometry;
+    const float* allValues;
+    size_t allNumEvents;
+    std::vector<float> allValueStorage;
+    std::shared_ptr<const void> allValuesOwner;
+
+    std::string valueCacheFilename;
+    const std::string valueParameters; // see ValueCache::computeHash()
+    const bool quantizeValueCache;
+    ValueCache valueCache;
 
-        RTree rt(positions.begin(), positions.end());
-        rtree = boost::move(rt);
-        LBINFO << " done" << std::endl;
-    }
-#endif
+    AABBf boundingBox;
 };
 
 EventSource::EventSource(const URIHandler& params)
@@ -320,13 +891,12 @@ EventSource::~EventSource()
 
 float& EventSource::operator[](const size_t index)
 {
-    return _impl->events
-        .get()[_impl->numEvents * Impl::EventOffsets::VALUE + index];
+    return _impl->editValues()[index];
 }
 
 size_t EventSource::getNumEvents() const
 {
-    return _impl->numEvents;
+    return _impl->getNumEvents();
 }
 
 const float* EventSource::getPositionsX() const
@@ -354,39 +924,64 @@ const float* EventSource::getValues() const
     return _impl->getValues();
 }
 
-EventValues EventSource::findEvents(const AABBf& area LB_UNUSED) const
+uint64_t EventSource::getValuesVersion() const
 {
-    EventValues eventValues;
-#ifdef USE_BOOST_GEOMETRY
-    if (!_impl->rtree.empty())
-    {
-        const Vector3f& p1 = area.getMin();
-        const Vector3f& p2 = area.getMax();
-        const Box query(Point(p1[0], p1[1], p1[2]), Point(p2[0], p2[1], p2[2]));
-
-        static lunchbox::a_ssize_t maxHits(0);
-        std::vector<Value> hits;
-        hits.reserve(maxHits);
-        _impl->rtree.query(bgi::intersects(query), std::back_inserter(hits));
-        maxHits = std::max(size_t(maxHits), hits.size());
-
-        eventValues.reserve(hits.size());
-        for (const Value& value : hits)
-            eventValues.push_back(getValues()[value.second]);
-    }
-    else
-#endif
-    // return empty
+    return _impl->valuesVersion;
+}
+
+uint64_t EventSource::getGeometryVersion() const
+{
+    return _impl->geometryVersion;
+}
+
+EventValues EventSource::findEvents(const AABBf& area) const
+{
+    EventValues result;
+    const float* values = getValues();
+    _impl->visit(area, [&](const size_t i) { result.push_back(values[i]); });
+    return result;
+}
+
+void EventSource::findEvents(const std::vector<AABBf>& areas,
+                             EventValues& values,
+                             std::vector<size_t>& offsets) const
+{
+    const float* eventValues = getValues();
+    const auto append = [&](const size_t i) {
+        values.push_back(eventValues[i]);
+    };
+
+    values.clear();
+    offsets.resize(areas.size() + 1);
+    for (size_t i = 0; i < areas.size(); ++i)
     {
-        static bool first = true;
-        if (first)
-        {
-            LBWARN << "RTree not available for findEvents. "
-                   << "No events will be returned" << std::endl;
-            first = false;
-        }
+        offsets[i] = values.size();
+        _impl->visit(areas[i], append);
     }
-    return eventValues;
+    offsets[areas.size()] = values.size();
+}
+
+void EventSource::forEachEvent(const AABBf& area,
+                               const EventVisitor& visitor) const
+{
+    _impl->visit(area, visitor);
+}
+
+float EventSource::sumValues(const AABBf& area) const
+{
+    const float* values = getValues();
+    float sum = 0.f;
+    _impl->visit(area, [&](const size_t i) { sum += values[i]; });
+    return sum;
+}
+
+float EventSource::maxValue(const AABBf& area, const float lowest) const
+{
+    const float* values = getValues();
+    float result = lowest;
+    _impl->visit(area,
+                 [&](const size_t i) { result = std::max(result, values[i]); });
+    return result;
 }
 
 void EventSource::setBoundingBox(const AABBf& boundingBox)
@@ -415,11 +1010,45 @@ void EventSource::update(const size_t i, const Vector3f& pos, const float rad,
     _impl->update(i, pos, rad, val);
 }
 
+void EventSource::update(const size_t first, const size_t count,
+                         const float* posx, const float* posy,
+                         const float* posz, const float* radii,
+                         const float* values)
+{
+    _impl->update(first, count, posx, posy, posz, radii, values);
+}
+
+void EventSource::adoptValues(const float* values,
+                              std::shared_ptr<const void> owner)
+{
+    _impl->adoptValues(values, owner);
+}
+
+void EventSource::selectEvents(const size_t first, const size_t count)
+{
+    _impl->selectEvents(first, count);
+}
+
+const ConstEventGeometryPtr& EventSource::getGeometry() const
+{
+    return _impl->geometry;
+}
+
+void EventSource::setGeometry(ConstEventGeometryPtr geometry)
+{
+    if (!geometry)
+        LBTHROW(std::invalid_argument("EventSource::setGeometry: null"));
+    _impl->setGeometry(geometry);
+}
+
+void EventSource::buildIndex()
+{
+    _impl->geometry->getIndex();
+}
+
 void EventSource::buildRTree()
 {
-#ifdef USE_BOOST_GEOMETRY
-    _impl->buildRTree();
-#endif
+    buildIndex();
 }
 
 bool EventSource::setFrame(const uint32_t frame)
@@ -437,6 +1066,16 @@ void EventSource::setTime(const double time)
     _impl->currentTime = time;
 }
 
+void EventSource::setFrameWindow(const Vector2ui& window)
+{
+    _impl->frameWindow = window;
+}
+
+const Vector2ui& EventSource::getFrameWindow() const
+{
+    return _impl->frameWindow;
+}
+
 Vector2ui EventSource::getFrameRange() const
 {
     const Vector2f& interval = _getTimeRange();
@@ -492,7 +1131,25 @@ ssize_t EventSource::load(const size_t chunkIndex, const size_t numChunks)
         LBTHROW(std::runtime_error("EventSource::load: numChunks must be > 0"));
     if (chunkIndex + numChunks > getNumChunks())
         LBTHROW(std::out_of_range("EventSource::load: Out of range"));
-    return _load(chunkIndex, numChunks);
+
+    // loaders write the values through operator[], which is not counted
+    ++_impl->valuesVersion;
+
+    // only complete frames are cached
+    if (_impl->valueCacheFilename.empty() || _getType() != SourceType::frame ||
+        numChunks != getNumChunks())
+    {
+        return _load(chunkIndex, numChunks);
+    }
+
+    const uint32_t frame = std::round(getCurrentTime() / getDt());
+    if (_impl->readCachedValues(*this, frame))
+        return getNumEvents();
+
+    const ssize_t updatedEvents = _load(chunkIndex, numChunks);
+    if (updatedEvents >= 0 && _impl->valueCache.isOpen())
+        _impl->valueCache.write(frame, getValues());
+    return updatedEvents;
 }
 
 ssize_t EventSource::load()
@@ -507,12 +1164,21 @@ size_t EventSource::getNumChunks() const
 
 bool EventSource::read(const std::string& filename)
 {
+    _impl->mapped = false;
+    if (_impl->readMapped(filename))
+        return true;
+
     if (_impl->readBinary(filename))
         return true;
 
     return _impl->readAscii(filename);
 }
 
+bool EventSource::isMapped() const
+{
+    return _impl->mapped;
+}
+
 bool EventSource::write(const std::string& filename,
                         const EventFileFormat format) const
 {
@@ -535,12 +1201,47 @@ bool EventSource::write(const std::string& filename,
             fData[index++] = getPositionsX()[i];
             fData[index++] = getPositionsY()[i];
             fData[index++] = getPositionsZ()[i];
-            fData[index++] = getRadii()[i];
+            fData[index++] = _invert(getRadii()[i]);
             fData[index++] = getValues()[i];
         }
         LBINFO << "Events file written as " << filename << std::endl;
         return true;
     }
+    case EventFileFormat::mapped:
+    {
+        const size_t columnSize = _getColumnSize(numEvents);
+        lunchbox::MemoryMap file(filename,
+                                 sizeof(MappedHeader) + 5 * columnSize);
+        MappedHeader* header = file.getAddress<MappedHeader>();
+        ::memset(header, 0, sizeof(MappedHeader));
+        header->magic = magic;
+        header->version = mappedVersion;
+        header->numEvents = numEvents;
+        header->columnSize = columnSize;
+        header->cutOffDistance = getCutOffDistance();
+        header->flags = _hasChecksums;
+
+        const AABBf& bbox = getGeometry()->getBoundingBox();
+        for (size_t i = 0; i < 3; ++i)
+        {
+            header->boundingBox[i] = bbox.getMin()[i];
+            header->boundingBox[i + 3] = bbox.getMax()[i];
+        }
+
+        const float* columns[] = {getPositionsX(), getPositionsY(),
+                                  getPositionsZ(), getRadii(), getValues()};
+        uint8_t* data = file.getAddress<uint8_t>() + sizeof(MappedHeader);
+        for (size_t i = 0; i < 5; ++i)
+        {
+            uint8_t* column = data + i * columnSize;
+            ::memset(column, 0, columnSize);
+            if (numEvents > 0)
+                ::memcpy(column, columns[i], numEvents * sizeof(float));
+            header->checksums[i] = kernels::hashWords(columns[i], numEvents);
+        }
+        LBINFO << "Events file written as " << filename << std::endl;
+        return true;
+    }
     case EventFileFormat::ascii:
     {
         std::ofstream file(filename.c_str());
@@ -556,8 +1257,8 @@ bool EventSource::write(const std::string& filename,
             for (size_t i = 0; i < numEvents; ++i)
             {
                 file << getPositionsX()[i] << " " << getPositionsY()[i] << " "
-                     << getPositionsZ()[i] << " " << getRadii()[i] << " "
-                     << getValues()[i] << std::endl;
+                     << getPositionsZ()[i] << " " << _invert(getRadii()[i])
+                     << " " << getValues()[i] << std::endl;
             }
             if (file.good())
                 LBINFO << "Events file written as " << filename << std::endl;
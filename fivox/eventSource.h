@@ -43,12 +43,42 @@ public:
 
     /**
      * Resize the underlying event structure to the specified size, and
-     * initialize all event attributes to 0
+     * initialize all event attributes to 0. Creates a new geometry which is
+     * not shared.
      *
      * @param numEvents the number of events that the EventSource will hold
      */
     FIVOX_API void resize(size_t numEvents);
 
+    /**
+     * @return the positions and radii of the events, shared by all users
+     *         until update() is called.
+     */
+    FIVOX_API const ConstEventGeometryPtr& getGeometry() const;
+
+    /**
+     * Use the given geometry for the events, instead of resize() and
+     * update(). The values are reset to 0.
+     *
+     * The geometry is shared and not modified, update() copies it first.
+     *
+     * @param geometry the positions and radii of the events.
+     * @throw std::invalid_argument if geometry is nullptr.
+     */
+    FIVOX_API void setGeometry(ConstEventGeometryPtr geometry);
+
+    /**
+     * Restrict the events to the range [first, first + count) of all events
+     * set before, e.g. to voxelize the chunks of a large event file one
+     * after the other. The positions and radii are used in place, the values
+     * of the range are copied.
+     *
+     * @param first the index of the first event of the range.
+     * @param count the number of events in the range.
+     * @throw std::out_of_range if the range exceeds the number of all events.
+     */
+    FIVOX_API void selectEvents(size_t first, size_t count);
+
     /**
      * Get a reference to the value of an event contained in the EventSource
      * by its index.
@@ -78,18 +108,66 @@ public:
     /** @return a const pointer to the events' values */
     FIVOX_API const float* getValues() const;
 
+    /**
+     * @return a counter which changes with each load(), update(),
+     *         adoptValues() or other replacement of the values, e.g. to detect
+     *         stale copies of the events. Values written through operator[]
+     *         outside of load() are not counted.
+     */
+    FIVOX_API uint64_t getValuesVersion() const;
+
+    /**
+     * @return a counter which changes whenever the positions or radii of the
+     *         events may have changed in place, without a new getGeometry().
+     */
+    FIVOX_API uint64_t getGeometryVersion() const;
+
     /**
      * Find all events in the given area.
      *
-     * Returns a vector of values corresponding to a conservative set of events,
-     * may contain events outside of the area, depending on the implementation.
+     * Uses the index from buildIndex(), or tests all events if it is not
+     * built.
      *
-     * @param area The query bounding box.
-     * @return The values of the events contained in the area. Empty if no RTree
-     * available (depends on boost::geometry)
+     * @param area The query bounding box, inclusive.
+     * @return The values of the events contained in the area.
      */
     FIVOX_API EventValues findEvents(const AABBf& area) const;
 
+    /**
+     * Find all events in each of the given areas.
+     *
+     * @param areas the query bounding boxes, inclusive.
+     * @param values the values of the events contained in each area, one
+     *        area after the other.
+     * @param offsets the first element in values for each area, with one
+     *        trailing element for the end of the last area.
+     */
+    FIVOX_API void findEvents(const std::vector<AABBf>& areas,
+                              EventValues& values,
+                              std::vector<size_t>& offsets) const;
+
+    /**
+     * Call the visitor with the index of each event in the given area.
+     *
+     * Does not allocate memory and is thread safe for concurrent queries.
+     * Capture the state of the visitor by reference to keep it within the
+     * small buffer of std::function.
+     *
+     * @param area the query bounding box, inclusive.
+     * @param visitor the function called for each event.
+     */
+    FIVOX_API void forEachEvent(const AABBf& area,
+                                const EventVisitor& visitor) const;
+
+    /** @return the sum of the values of the events in the given area. */
+    FIVOX_API float sumValues(const AABBf& area) const;
+
+    /**
+     * @return the maximum of lowest and the values of the events in the
+     *         given area.
+     */
+    FIVOX_API float maxValue(const AABBf& area, float lowest) const;
+
     /**
      * Set bounding box of upcoming events. This overwrites any existing
      * bounding box. It can be used to set a bounding box before
@@ -108,7 +186,8 @@ public:
     /**
      * Update attributes of the event specified by the index. Update also the
      * bounding box to include the new position. The specified index should
-     * be smaller than the size used in resize()
+     * be smaller than the size used in resize(). Copies the geometry first if
+     * it is shared, see getGeometry().
      * Not thread safe.
      *
      * @param i the index of the event that will be updated
@@ -119,11 +198,46 @@ public:
     FIVOX_API void update(size_t i, const Vector3f& pos, float rad,
                           float val = 0.f);
 
+    /**
+     * Update the attributes of the events [first, first + count), and the
+     * bounding box to include their positions. Copies the geometry first if
+     * it is shared, see getGeometry().
+     *
+     * Thread safe for disjoint ranges, so loaders can create the events of
+     * a large source in parallel.
+     *
+     * @param first the index of the first event to update.
+     * @param count the number of events to update.
+     * @param posx, posy, posz the event positions.
+     * @param radii the event radii, or nullptr to keep the current radii.
+     * @param values the event values, or nullptr to keep the current
+     *        values.
+     * @throw std::out_of_range if the range exceeds getNumEvents().
+     */
+    FIVOX_API void update(size_t first, size_t count, const float* posx,
+                          const float* posy, const float* posz,
+                          const float* radii, const float* values);
+
+    /**
+     * Use the given values of all events in place instead of copying them,
+     * e.g. a frame loaded in the order of the events. The values are copied
+     * before the first change through operator[] or update().
+     *
+     * @param values the value of each event.
+     * @param owner keeps the values valid while they are in use.
+     */
+    FIVOX_API void adoptValues(const float* values,
+                               std::shared_ptr<const void> owner);
+
     /**
      * @internal Called before data is read. Not thread safe.
-     * Build an RTree so it can be used from findEvents() (depends
-     * on boost::geometry)
+     * Build the spatial index over the event positions used by findEvents().
+     * The index is part of the geometry and stays valid until the events are
+     * resized or updated.
      */
+    FIVOX_API void buildIndex();
+
+    /** @deprecated use buildIndex() */
     FIVOX_API void buildRTree();
 
     /**
@@ -151,6 +265,20 @@ public:
      */
     FIVOX_API Vector2ui getFrameRange() const;
 
+    /**
+     * Declare the frames which will be loaded one after the other, so that
+     * loaders may read them ahead of the current frame.
+     *
+     * Report loaders read up to URIHandler::getReadAhead() frames of the
+     * window ahead, each of them held in memory until it is loaded.
+     *
+     * @param window the frames in the [a, b) range, empty by default.
+     */
+    FIVOX_API void setFrameWindow(const Vector2ui& window);
+
+    /** @return the frames declared by setFrameWindow(). */
+    FIVOX_API const Vector2ui& getFrameWindow() const;
+
     /**
      * @param frame The frame number to be checked.
      * @return Checks the frame range, if the frame is satisfying [a, b)
@@ -187,6 +315,10 @@ public:
     /**
      * Load and update all events of the current frame.
      *
+     * For frame sources with the 'valueCache' URI parameter, the values of
+     * the frames are written to the given ValueCache file, and taken from
+     * it instead of loading the frame again if present.
+     *
      * @return the number of updated events, or -1 if the load failed.
      */
     FIVOX_API ssize_t load();
@@ -199,6 +331,11 @@ public:
      * binary file, checking the expected magic number; if not found, it will
      * read it as an ASCII, in the expected format (see specification).
      *
+     * Files in the binary format version 2 (EventFileFormat::mapped) are
+     * mapped into memory and used in place, without copying or converting
+     * the events. ASCII files are parsed in parallel, reporting the line of
+     * the first ill-formed event.
+     *
      * The contents of the file will be used to set the events in the
      * EventSource.
      *
@@ -212,13 +349,20 @@ public:
      */
     FIVOX_API bool read(const std::string& filename);
 
+    /**
+     * @return true if the events of the last read() are used in place from a
+     *         mapped file, false if they were copied into memory.
+     */
+    FIVOX_API bool isMapped() const;
+
     /**
      * Write events to the specified file. It is possible to specify the format
      * of the output (binary or ASCII, see specification for reference).
      *
      * @param filename path of the file to write the events to.
      * @param format file format in which the event file will be written
-     * (EventFileFormat::ascii and EventFileFormat::binary are supported).
+     * (EventFileFormat::ascii, EventFileFormat::binary and
+     * EventFileFormat::mapped are supported).
      * @return true if the file was succesfully written, false otherwise.
      */
     FIVOX_API bool write(const std::string& filename,
@@ -246,6 +390,13 @@ protected:
     virtual size_t _getNumChunks() const = 0;
     //@}
 
+    /**
+     * @return the options of the source which determine the event values,
+     *         besides its URI parameters, to identify the frames of its
+     *         value cache. Empty by default.
+     */
+    virtual std::string _getValueOptions() const { return std::string(); }
+
     /**
      * Set the dt that the datasource is using to correctly compute frame
      * number from time in load().
@@ -22,6 +22,7 @@
 #define FIVOX_EVENTVALUESUMMATIONIMAGESOURCE_HXX
 
 #include "eventValueSummationImageSource.h"
+#include "kernels.h"
 
 #include <itkProgressReporter.h>
 
@@ -51,6 +52,21 @@ void EventValueSummationImageSource< TImage >::GenerateData()
     size_t totalEvents = 0;
     typename TImage::PixelType maxValue = 0;
 
+    // the linear voxel index of the events is computed in batches by the SIMD
+    // kernels, the image has no direction and is fully buffered
+    const auto& region = image->GetBufferedRegion();
+    Vector3f origin, invSpacing;
+    Vector3ui size;
+    for( size_t i = 0; i < 3; ++i )
+    {
+        invSpacing[i] = 1.f / image->GetSpacing()[i];
+        origin[i] = image->GetOrigin()[i] +
+                    region.GetIndex()[i] * image->GetSpacing()[i];
+        size[i] = region.GetSize()[i];
+    }
+    typename TImage::PixelType* buffer = image->GetBufferPointer();
+    std::vector< int64_t > indices;
+
     // start with batch size of at most 10, adapts to target time wrt loading
     // time of event source
     size_t batchSize = std::min( size_t(10), numChunks );
@@ -60,26 +76,24 @@ void EventValueSummationImageSource< TImage >::GenerateData()
         lunchbox::Clock clock;
         totalEvents += source->load( i, batchSize );
 
-        const float* __restrict__ posx = source->getPositionsX();
-        const float* __restrict__ posy = source->getPositionsY();
-        const float* __restrict__ posz = source->getPositionsZ();
-        const float* __restrict__ values = source->getValues();
+        const size_t numEvents = source->getNumEvents();
+        const float* values = source->getValues();
+        indices.resize( numEvents );
+        kernels::computeVoxelIndices( source->getPositionsX(),
+                                      source->getPositionsY(),
+                                      source->getPositionsZ(), numEvents,
+                                      origin, invSpacing, size,
+                                      indices.data( ));
 
-        #pragma vector aligned
-        for( size_t j = 0; j < source->getNumEvents(); ++j )
+        for( size_t j = 0; j < numEvents; ++j )
         {
-            typename TImage::PointType point;
-            point[0] = posx[j];
-            point[1] = posy[j];
-            point[2] = posz[j];
-            typename Superclass::ImageIndexType index;
-            if( image->TransformPhysicalPointToIndex( point, index ))
-            {
-                const typename TImage::PixelType value =
-                        image->GetPixel( index ) + values[j];
-                maxValue = std::max( maxValue, value );
-                image->SetPixel( index, value );
-            }
+            if( indices[j] < 0 )
+                continue;
+
+            const typename TImage::PixelType value =
+                    buffer[indices[j]] + values[j];
+            maxValue = std::max( maxValue, value );
+            buffer[indices[j]] = value;
         }
 
         for( size_t j = 0; j < batchSize; ++j )
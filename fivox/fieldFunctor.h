@@ -24,6 +24,9 @@
 #include <brion/types.h>
 #include <fivox/api.h>
 #include <fivox/eventFunctor.h> // base class
+#include <fivox/eventGrid.h>    // member
+#include <fivox/eventSource.h>
+#include <fivox/kernels.h>
 
 namespace fivox
 {
@@ -42,8 +45,48 @@ public:
     {
     }
     FIVOX_API virtual ~FieldFunctor() {}
+    /**
+     * Bin the events into a grid with cells of the size of the cutoff
+     * distance, so each voxel only visits the events of its neighbour cells.
+     */
+    FIVOX_API void beforeGenerate() override
+    {
+        if (Super::_source)
+            _grid.build(*Super::_source, Super::_source->getCutOffDistance());
+    }
+
+    FIVOX_API bool isLinear() const override { return true; }
+
     FIVOX_API TPixel operator()(const TPoint& point,
                                 const TSpacing& spacing) const override;
+
+    /**
+     * Sample a line of voxels with the events as the outer loop, so each
+     * event is only loaded once for all voxels of the line within the cutoff.
+     */
+    FIVOX_API void sampleLine(const TPoint& point, const TSpacing& spacing,
+                              size_t size, TPixel* output) const override;
+
+    /**
+     * Add the events around the block to the voxels within their cutoff
+     * sphere, so the cost depends on the number of events and not voxels.
+     */
+    FIVOX_API bool splat(const TPoint& origin, const TSpacing& spacing,
+                         const Vector3ui& size, float* output) const override;
+
+    /** The field is linear in the event values. */
+    FIVOX_API bool splatEvents(const float* posx, const float* posy,
+                               const float* posz, const float* radii,
+                               const float* values, size_t numEvents,
+                               const TPoint& origin, const TSpacing& spacing,
+                               const Vector3ui& size,
+                               float* output) const override;
+
+private:
+    EventGrid _grid;
+
+    void _sampleSegment(const Vector3f& point, float step, size_t size,
+                        float* output) const;
 };
 
 template <class TImage>
@@ -54,52 +97,146 @@ inline typename FieldFunctor<TImage>::TPixel FieldFunctor<TImage>::operator()(
         return 0;
 
     const float cutOffDistance = Super::_source->getCutOffDistance();
+    const Vector3f position(point[0], point[1], point[2]);
+
+    // beforeGenerate() was not called since the events changed, e.g. when
+    // sampling single points
+    if (!_grid.isCurrent(*Super::_source))
+    {
+        return kernels::sampleField(Super::_source->getPositionsX(),
+                                    Super::_source->getPositionsY(),
+                                    Super::_source->getPositionsZ(),
+                                    Super::_source->getRadii(),
+                                    Super::_source->getValues(), 0,
+                                    Super::_source->getNumEvents(), position,
+                                    cutOffDistance);
+    }
+
+    Vector3ui begin, end;
+    if (!_grid.getCells(AABBf(position - cutOffDistance,
+                              position + cutOffDistance),
+                        begin, end))
+    {
+        return 0;
+    }
+
+    // the events of consecutive cells along X are contiguous in the grid
+    float voltage(0.f);
+    for (size_t z = begin[2]; z < end[2]; ++z)
+        for (size_t y = begin[1]; y < end[1]; ++y)
+            voltage += kernels::sampleField(
+                _grid.getPositionsX(), _grid.getPositionsY(),
+                _grid.getPositionsZ(), _grid.getRadii(), _grid.getValues(),
+                _grid.getEventIndex(begin[0], y, z),
+                _grid.getEventIndex(end[0], y, z), position, cutOffDistance);
+    return voltage;
+}
+
+template <class TImage>
+inline void FieldFunctor<TImage>::sampleLine(const TPoint& point,
+                                             const TSpacing& spacing,
+                                             const size_t size,
+                                             TPixel* output) const
+{
+    if (!Super::_source || !_grid.isCurrent(*Super::_source))
+    {
+        Super::sampleLine(point, spacing, size, output);
+        return;
+    }
+
+    // accumulate on the stack in float, in segments of bounded length
+    const size_t segmentSize = 256;
+    float values[segmentSize];
+
+    const float step = spacing[0];
+    for (size_t i = 0; i < size; i += segmentSize)
+    {
+        const size_t numVoxels = std::min(segmentSize, size - i);
+        _sampleSegment(Vector3f(point[0] + i * spacing[0], point[1], point[2]),
+                       step, numVoxels, values);
+        for (size_t j = 0; j < numVoxels; ++j)
+            output[i + j] = values[j];
+    }
+}
+
+template <class TImage>
+inline bool FieldFunctor<TImage>::splat(const TPoint& origin,
+                                        const TSpacing& spacing,
+                                        const Vector3ui& size,
+                                        float* output) const
+{
+    if (!Super::_source || !_grid.isCurrent(*Super::_source))
+    {
+        return false;
+    }
+
+    const float cutOffDistance = Super::_source->getCutOffDistance();
+    const Vector3f first(origin[0], origin[1], origin[2]);
+    const Vector3f step(spacing[0], spacing[1], spacing[2]);
+    const Vector3f last = first + step * (Vector3f(size) - 1.f);
+
+    Vector3ui begin, end;
+    if (!_grid.getCells(AABBf(first - cutOffDistance, last + cutOffDistance),
+                        begin, end))
+    {
+        return true;
+    }
+
+    for (size_t z = begin[2]; z < end[2]; ++z)
+        for (size_t y = begin[1]; y < end[1]; ++y)
+            kernels::splatField(_grid.getPositionsX(), _grid.getPositionsY(),
+                                _grid.getPositionsZ(), _grid.getRadii(),
+                                _grid.getValues(),
+                                _grid.getEventIndex(begin[0], y, z),
+                                _grid.getEventIndex(end[0], y, z), first, step,
+                                size, cutOffDistance, output);
+    return true;
+}
+
+template <class TImage>
+inline bool FieldFunctor<TImage>::splatEvents(
+    const float* posx, const float* posy, const float* posz,
+    const float* radii, const float* values, const size_t numEvents,
+    const TPoint& origin, const TSpacing& spacing, const Vector3ui& size,
+    float* output) const
+{
+    if (!Super::_source)
+        return false;
+
+    kernels::splatField(posx, posy, posz, radii, values, 0, numEvents,
+                        Vector3f(origin[0], origin[1], origin[2]),
+                        Vector3f(spacing[0], spacing[1], spacing[2]), size,
+                        Super::_source->getCutOffDistance(), output);
+    return true;
+}
+
+template <class TImage>
+inline void FieldFunctor<TImage>::_sampleSegment(const Vector3f& point,
+                                                 const float step,
+                                                 const size_t size,
+                                                 float* output) const
+{
+    std::fill(output, output + size, 0.f);
+
+    const float cutOffDistance = Super::_source->getCutOffDistance();
+    Vector3f last(point);
+    last[0] += step * (size - 1);
 
-    const size_t size = Super::_source->getNumEvents();
-    // By using the restrict keyword, we specify that the object will only
-    // be accessed by the declared pointer, which helps for the optimization
-    const float* __restrict__ posx = Super::_source->getPositionsX();
-    const float* __restrict__ posy = Super::_source->getPositionsY();
-    const float* __restrict__ posz = Super::_source->getPositionsZ();
-    const float* __restrict__ radii = Super::_source->getRadii();
-    const float* __restrict__ values = Super::_source->getValues();
-
-    const float px(point[0]), py(point[1]), pz(point[2]);
-
-    // Compute directly the inverted value to gain performance in the for loop
-    const float squaredCutoff = 1.f / (cutOffDistance * cutOffDistance);
-    float voltage1(0.f), voltage2(0.f);
-
-// Tell the compiler that memory accesses are aligned (done in
-// EventSource::resize) so it is able to make optimizations
-#pragma vector aligned
-    for (size_t i = 0; i < size; ++i)
+    Vector3ui begin, end;
+    if (!_grid.getCells(AABBf(point - cutOffDistance, last + cutOffDistance),
+                        begin, end))
     {
-        const float distanceX = px - posx[i];
-        const float distanceY = py - posy[i];
-        const float distanceZ = pz - posz[i];
-
-        const float distance2(1.f /
-                              (distanceX * distanceX + distanceY * distanceY +
-                               distanceZ * distanceZ));
-
-        // Comparison is inverted, as we are using the reciprocal values
-        if (distance2 < squaredCutoff)
-            continue;
-
-        const float value(values[i]);
-
-        // If center of the voxel within the event radius, use the
-        // voltage at the surface of the compartment (at 'radius' distance)
-        const float radius(radii[i]);
-        // Comparison is inverted, as we are using the reciprocal values
-        // (radius is already inverted from the loader)
-        if (distance2 > radius * radius)
-            voltage1 += value * radius; // mV
-        else
-            voltage2 += value * distance2; // mV
+        return;
     }
-    return voltage1 + voltage2;
+
+    for (size_t z = begin[2]; z < end[2]; ++z)
+        for (size_t y = begin[1]; y < end[1]; ++y)
+            kernels::sampleFieldLine(
+                _grid.getPositionsX(), _grid.getPositionsY(),
+                _grid.getPositionsZ(), _grid.getRadii(), _grid.getValues(),
+                _grid.getEventIndex(begin[0], y, z),
+                _grid.getEventIndex(end[0], y, z), point, step, size,
+                cutOffDistance, output);
 }
 }
 
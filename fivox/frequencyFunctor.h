@@ -45,7 +45,7 @@ public:
     FIVOX_API void beforeGenerate() override
     {
         if (Super::_source)
-            Super::_source->buildRTree();
+            Super::_source->buildIndex();
     }
 
     FIVOX_API TPixel operator()(const TPoint& point,
@@ -69,13 +69,7 @@ inline typename FrequencyFunctor<TImage>::TPixel FrequencyFunctor<TImage>::
     }
 
     const AABBf region(point - spacing_2, point + spacing_2);
-    const EventValues& values = Super::_source->findEvents(region);
-
-    float sum = 0.f;
-    for (const float& value : values)
-        sum = std::max(sum, value);
-
-    return sum;
+    return Super::_source->maxValue(region, 0.f);
 }
 }
 
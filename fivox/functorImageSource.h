@@ -51,6 +51,60 @@ public:
     /** Set a new functor. */
     void setFunctor(FunctorPtr functor);
 
+    /**
+     * Set how the voxel values are computed, SamplingMode::gather by default.
+     *
+     * With SamplingMode::splat, each thread adds the events to its region of
+     * the volume. Functors which do not implement
+     * EventFunctor::splat() are sampled per voxel. SamplingMode::convolution,
+     * SamplingMode::matrix and SamplingMode::binning are implemented by
+     * ConvolutionImageSource, InfluenceMatrixImageSource and
+     * BinningImageSource, and gather here.
+     */
+    void setSamplingMode(SamplingMode mode);
+
+    /** @return how the voxel values are computed. */
+    SamplingMode getSamplingMode() const;
+
+    /**
+     * Update the volume of the previous frame with the events whose value
+     * changed by more than the given tolerance, instead of recomputing it,
+     * for functors which implement EventFunctor::splatEvents(). Negative to
+     * disable, the default.
+     *
+     * The volume is recomputed with EventFunctor::splat() if the events, the
+     * volume or the functor changed, or if more than the maximum fraction of
+     * events changed. The error of each voxel is bounded by the field of the
+     * events with the tolerance as value.
+     */
+    void setDeltaTolerance(float tolerance);
+
+    /** @return the minimum change of an event value to update the volume. */
+    float getDeltaTolerance() const;
+
+    /**
+     * Set the fraction of changed events above which the volume is
+     * recomputed, 0.5 by default.
+     */
+    void setMaxDeltaFraction(float fraction);
+
+    /** @return the fraction of changed events to recompute the volume. */
+    float getMaxDeltaFraction() const;
+
+    /**
+     * Voxelize the chunks of the event source one after the other and add up
+     * their volumes, instead of loading all events at once. Disabled by
+     * default.
+     *
+     * Only linear functors (EventFunctor::isLinear()) on float volumes are
+     * voxelized by chunk, the volume is computed once per chunk and delta
+     * updates are not used.
+     */
+    void setChunkedLoading(bool enable);
+
+    /** @return true if the event source is voxelized chunk by chunk. */
+    bool getChunkedLoading() const;
+
 protected:
     FunctorImageSource();
     virtual ~FunctorImageSource() {}
@@ -69,10 +123,38 @@ protected:
 
     void BeforeThreadedGenerateData() override;
 
+    void GenerateData() override;
+
 private:
     FunctorPtr _functor;
+    SamplingMode _samplingMode;
     lunchbox::Monitor<size_t> _completed;
     itk::ImageRegionSplitterBase::Pointer _splitter;
+    bool _chunkedLoading;
+    size_t _chunk; // loaded by BeforeThreadedGenerateData(), or _allChunks
+
+    // state of the previous frame for incremental updates
+    float _deltaTolerance;
+    float _maxDeltaFraction;
+    bool _isIncremental;
+    // compared by owner, and by version for changes in place
+    std::weak_ptr<const EventGeometry> _geometry;
+    uint64_t _geometryVersion;
+    typename Superclass::ImageRegionType _region;
+    typename TImage::PointType _origin;
+    typename TImage::SpacingType _spacing;
+    std::vector<float> _values; // event values of _volume
+    std::vector<float> _volume; // of _region, X fastest
+
+    // changed events, with the difference of their values
+    std::vector<float> _deltaPosX;
+    std::vector<float> _deltaPosY;
+    std::vector<float> _deltaPosZ;
+    std::vector<float> _deltaRadii;
+    std::vector<float> _deltaValues;
+
+    void _resetDeltas();
+    bool _updateTile(const typename Superclass::ImageRegionType& region);
 };
 
 } // end namespace fivox
@@ -22,17 +22,31 @@
 #define FIVOX_FUNCTORIMAGESOURCE_HXX
 
 #include "functorImageSource.h"
+#include "eventSource.h"
 
 #include <itkImageLinearIteratorWithIndex.h>
+#include <itkImageRegionConstIterator.h>
+#include <itkImageRegionIterator.h>
 #include <itkImageRegionSplitterDirection.h>
 #include <itkProgressReporter.h>
 
+#include <limits>
+#include <type_traits>
+
 namespace fivox
 {
 static const int _splitDirection = 2; // fastest in latest test
+static const size_t _allChunks = std::numeric_limits< size_t >::max();
 
 template< typename TImage > FunctorImageSource< TImage >::FunctorImageSource()
     : ImageSource< TImage >()
+    , _samplingMode( SamplingMode::gather )
+    , _chunkedLoading( false )
+    , _chunk( _allChunks )
+    , _deltaTolerance( -1.f )
+    , _maxDeltaFraction( 0.5f )
+    , _isIncremental( false )
+    , _geometryVersion( 0 )
 {
     itk::ImageRegionSplitterDirection::Pointer splitter =
         itk::ImageRegionSplitterDirection::New();
@@ -50,6 +64,94 @@ template< typename TImage >
 void FunctorImageSource< TImage >::setFunctor( FunctorPtr functor )
 {
     _functor = functor;
+    _values.clear(); // recompute the next volume
+}
+
+template< typename TImage >
+void FunctorImageSource< TImage >::setSamplingMode( const SamplingMode mode )
+{
+    _samplingMode = mode;
+}
+
+template< typename TImage >
+SamplingMode FunctorImageSource< TImage >::getSamplingMode() const
+{
+    return _samplingMode;
+}
+
+template< typename TImage >
+void FunctorImageSource< TImage >::setDeltaTolerance( const float tolerance )
+{
+    _deltaTolerance = tolerance;
+}
+
+template< typename TImage >
+float FunctorImageSource< TImage >::getDeltaTolerance() const
+{
+    return _deltaTolerance;
+}
+
+template< typename TImage >
+void FunctorImageSource< TImage >::setMaxDeltaFraction( const float fraction )
+{
+    _maxDeltaFraction = fraction;
+}
+
+template< typename TImage >
+float FunctorImageSource< TImage >::getMaxDeltaFraction() const
+{
+    return _maxDeltaFraction;
+}
+
+template< typename TImage >
+void FunctorImageSource< TImage >::setChunkedLoading( const bool enable )
+{
+    _chunkedLoading = enable;
+}
+
+template< typename TImage >
+bool FunctorImageSource< TImage >::getChunkedLoading() const
+{
+    return _chunkedLoading;
+}
+
+template< typename TImage >
+void FunctorImageSource< TImage >::GenerateData()
+{
+    auto source = Superclass::_eventSource;
+    const size_t numChunks = source ? source->getNumChunks() : 0;
+    if( !_chunkedLoading || numChunks < 2 || !_functor->isLinear() ||
+        !std::is_same< typename TImage::PixelType, float >::value )
+    {
+        Superclass::GenerateData();
+        return;
+    }
+
+    // only the events of one chunk are in memory, the volumes of the chunks
+    // add up to the volume of all events for linear functors
+    typename Superclass::ImagePointer image = Superclass::GetOutput();
+    std::vector< float > volume;
+    for( _chunk = 0; _chunk < numChunks; ++_chunk )
+    {
+        Superclass::GenerateData();
+
+        const auto& region = image->GetRequestedRegion();
+        volume.resize( region.GetNumberOfPixels( ));
+        itk::ImageRegionConstIterator< TImage > i( image, region );
+        for( float& value : volume )
+        {
+            value += i.Get();
+            ++i;
+        }
+    }
+    _chunk = _allChunks;
+
+    itk::ImageRegionIterator< TImage > i( image, image->GetRequestedRegion( ));
+    for( const float value : volume )
+    {
+        i.Set( value );
+        ++i;
+    }
 }
 
 template< typename TImage >
@@ -58,41 +160,79 @@ void FunctorImageSource< TImage >::ThreadedGenerateData(
     const itk::ThreadIdType threadId )
 {
     typename Superclass::ImagePointer image = Superclass::GetOutput();
-    typedef itk::ImageLinearIteratorWithIndex< TImage > ImageIterator;
-    ImageIterator i( image, outputRegionForThread );
-    i.SetDirection(0);
-    i.GoToBegin();
-
+    const typename TImage::SpacingType spacing = image->GetSpacing();
     const size_t nLines = image->GetRequestedRegion().GetSize()[1] *
                           image->GetRequestedRegion().GetSize()[2];
     itk::ProgressReporter progress( this, threadId, nLines );
     size_t totalLines = 0;
 
-    while( !i.IsAtEnd( ))
+    // report progress only once per line for lower contention on monitor.
+    // Main thread reports to itk, all others to the monitor.
+    const auto reportLines = [&]( const size_t lines )
     {
-        const typename Superclass::ImageIndexType& index = i.GetIndex();
+        if( threadId == 0 )
+        {
+            size_t done = _completed.set( 0 ) + lines /*self*/;
+            totalLines += done;
+            while( done-- )
+                progress.CompletedPixel();
+        }
+        else
+            _completed += lines;
+    };
 
-        const typename TImage::SpacingType spacing = image->GetSpacing();
-        typename TImage::PointType point;
-        image->TransformIndexToPhysicalPoint( index, point );
+    bool splatted = false;
+    if( _deltaTolerance >= 0.f && _chunk == _allChunks &&
+        _updateTile( outputRegionForThread ))
+    {
+        reportLines( outputRegionForThread.GetSize()[1] *
+                     outputRegionForThread.GetSize()[2] );
+        splatted = true;
+    }
 
-        i.Set( (*_functor)( point, spacing ) );
+    if( !splatted && _samplingMode == SamplingMode::splat )
+    {
+        // the regions of the threads are disjoint, so the events are added
+        // to a private tile without synchronization
+        const auto& size = outputRegionForThread.GetSize();
+        const Vector3ui tileSize( size[0], size[1], size[2] );
+        std::vector< float > tile( size_t( size[0] ) * size[1] * size[2] );
 
-        ++i;
-        if( i.IsAtEndOfLine( ))
+        typename TImage::PointType origin;
+        image->TransformIndexToPhysicalPoint( outputRegionForThread.GetIndex(),
+                                              origin );
+        if( _functor->splat( origin, spacing, tileSize, tile.data( )))
         {
-            i.NextLine();
-            // report progress only once per line for lower contention on
-            // monitor. Main thread reports to itk, all others to the monitor.
-            if( threadId == 0 )
+            itk::ImageRegionIterator< TImage > i( image,
+                                                  outputRegionForThread );
+            for( const float value : tile )
             {
-                size_t done = _completed.set( 0 ) + 1 /*self*/;
-                totalLines += done;
-                while( done-- )
-                    progress.CompletedPixel();
+                i.Set( value );
+                ++i;
             }
-            else
-                ++_completed;
+            reportLines( size[1] * size[2] );
+            splatted = true;
+        }
+    }
+
+    if( !splatted )
+    {
+        typedef itk::ImageLinearIteratorWithIndex< TImage > ImageIterator;
+        ImageIterator i( image, outputRegionForThread );
+        i.SetDirection(0);
+        i.GoToBegin();
+
+        const size_t lineSize = outputRegionForThread.GetSize()[0];
+        while( !i.IsAtEnd( ))
+        {
+            // sample the whole line at once, the pixels of a line along X are
+            // contiguous in the output buffer
+            typename TImage::PointType point;
+            image->TransformIndexToPhysicalPoint( i.GetIndex(), point );
+            _functor->sampleLine( point, spacing, lineSize, &i.Value( ));
+
+            i.NextLine();
+            reportLines( 1 );
         }
     }
 
@@ -117,7 +257,8 @@ void FunctorImageSource< TImage >::BeforeThreadedGenerateData()
     if( !source )
         return;
 
-    const ssize_t updatedEvents = source->load();
+    const ssize_t updatedEvents =
+        _chunk == _allChunks ? source->load() : source->load( _chunk, 1 );
     const float time = source->getCurrentTime();
     if( updatedEvents < 0 )
     {
@@ -132,9 +273,139 @@ void FunctorImageSource< TImage >::BeforeThreadedGenerateData()
 
     _completed = 0;
     _functor->beforeGenerate();
+    _resetDeltas();
     Superclass::_progressObserver->reset();
 }
 
+template< typename TImage >
+void FunctorImageSource< TImage >::_resetDeltas()
+{
+    _isIncremental = false;
+    _deltaPosX.clear();
+    _deltaPosY.clear();
+    _deltaPosZ.clear();
+    _deltaRadii.clear();
+    _deltaValues.clear();
+
+    auto source = Superclass::_eventSource;
+    if( _deltaTolerance < 0.f || !source || _chunk != _allChunks )
+    {
+        std::vector< float >().swap( _values );
+        std::vector< float >().swap( _volume );
+        _geometry.reset();
+        return;
+    }
+
+    const size_t numEvents = source->getNumEvents();
+    const float* values = source->getValues();
+    typename Superclass::ImagePointer image = Superclass::GetOutput();
+    const auto& region = image->GetRequestedRegion();
+
+    const ConstEventGeometryPtr& geometry = source->getGeometry();
+    bool recompute = _values.size() != numEvents ||
+                     _geometry.owner_before( geometry ) ||
+                     geometry.owner_before( _geometry ) ||
+                     source->getGeometryVersion() != _geometryVersion ||
+                     region != _region || image->GetOrigin() != _origin ||
+                     image->GetSpacing() != _spacing;
+
+    // the volume follows the values of the events which changed enough
+    const size_t maxDeltas = _maxDeltaFraction * numEvents;
+    for( size_t i = 0; i < numEvents && !recompute; ++i )
+    {
+        const float delta = values[i] - _values[i];
+        if( std::abs( delta ) <= _deltaTolerance )
+            continue;
+
+        _deltaPosX.push_back( source->getPositionsX()[i] );
+        _deltaPosY.push_back( source->getPositionsY()[i] );
+        _deltaPosZ.push_back( source->getPositionsZ()[i] );
+        _deltaRadii.push_back( source->getRadii()[i] );
+        _deltaValues.push_back( delta );
+        _values[i] = values[i];
+        recompute = _deltaValues.size() > maxDeltas;
+    }
+
+    if( recompute )
+    {
+        _deltaPosX.clear();
+        _deltaPosY.clear();
+        _deltaPosZ.clear();
+        _deltaRadii.clear();
+        _deltaValues.clear();
+        _values.assign( values, values + numEvents );
+        _volume.resize( region.GetNumberOfPixels( ));
+        _geometry = geometry;
+        _geometryVersion = source->getGeometryVersion();
+        _region = region;
+        _origin = image->GetOrigin();
+        _spacing = image->GetSpacing();
+        return;
+    }
+
+    _isIncremental = true;
+    LBINFO << "Updating volume with " << _deltaValues.size() << " of "
+           << numEvents << " event(s)" << std::endl;
+}
+
+template< typename TImage >
+bool FunctorImageSource< TImage >::_updateTile(
+    const typename Superclass::ImageRegionType& region )
+{
+    typename Superclass::ImagePointer image = Superclass::GetOutput();
+    const auto& size = region.GetSize();
+    const Vector3ui tileSize( size[0], size[1], size[2] );
+    std::vector< float > tile( size_t( size[0] ) * size[1] * size[2] );
+
+    typename TImage::PointType origin;
+    image->TransformIndexToPhysicalPoint( region.GetIndex(), origin );
+    const typename TImage::SpacingType spacing = image->GetSpacing();
+
+    // rows of the tile along X in the volume of the previous frame
+    const auto& volumeSize = _region.GetSize();
+    const auto getRow = [&]( const size_t y, const size_t z )
+    {
+        const size_t volumeY = region.GetIndex()[1] - _region.GetIndex()[1] + y;
+        const size_t volumeZ = region.GetIndex()[2] - _region.GetIndex()[2] + z;
+        return _volume.data() + region.GetIndex()[0] - _region.GetIndex()[0] +
+               volumeSize[0] * ( volumeY + volumeSize[1] * volumeZ );
+    };
+
+    bool updated = false;
+    if( _isIncremental )
+    {
+        float* row = tile.data();
+        for( size_t z = 0; z < size[2]; ++z )
+            for( size_t y = 0; y < size[1]; ++y, row += size[0] )
+                std::copy( getRow( y, z ), getRow( y, z ) + size[0], row );
+
+        updated = _functor->splatEvents( _deltaPosX.data(), _deltaPosY.data(),
+                                         _deltaPosZ.data(), _deltaRadii.data(),
+                                         _deltaValues.data(),
+                                         _deltaValues.size(), origin, spacing,
+                                         tileSize, tile.data( ));
+    }
+    if( !updated )
+    {
+        std::fill( tile.begin(), tile.end(), 0.f );
+        if( !_functor->splat( origin, spacing, tileSize, tile.data( )))
+            return false;
+    }
+
+    const float* row = tile.data();
+    for( size_t z = 0; z < size[2]; ++z )
+        for( size_t y = 0; y < size[1]; ++y, row += size[0] )
+            std::copy( row, row + size[0], getRow( y, z ));
+
+    itk::ImageRegionIterator< TImage > i( image, region );
+    for( const float value : tile )
+    {
+        i.Set( value );
+        ++i;
+    }
+    return true;
+}
+
 } // end namespace fivox
 
 #endif
@@ -21,6 +21,7 @@
  */
 
 #include "genericLoader.h"
+#include "eventGrid.h"
 #include "uriHandler.h"
 
 #include <lunchbox/log.h>
@@ -31,12 +32,22 @@
 
 namespace fivox
 {
+namespace
+{
+// memory of an event in a chunk: its value selected from the file, and its
+// copy binned by the functor
+const size_t _bytesPerEvent = sizeof(float) + EventGrid::getMemoryPerEvent();
+}
+
 class GenericLoader::Impl
 {
 public:
     explicit Impl(EventSource& output, const URIHandler& params)
         : _output(output)
         , _file(params.getConfigPath())
+        , _numEvents(0)
+        , _numChunks(1)
+        , _chunkSize(0)
     {
         if (_file.empty())
         {
@@ -52,19 +63,48 @@ public:
         }
 
         _output.read(_file);
+        _numEvents = _output.getNumEvents();
+        _chunkSize = _numEvents;
+
+        const size_t maxEventMemory = params.getMaxEventMemory();
+        const size_t memory = _numEvents * _bytesPerEvent;
+        if (maxEventMemory == 0 || memory <= maxEventMemory)
+            return;
+
+        if (!_output.isMapped())
+            LBWARN << "Only binary version 2 event files are loaded in chunks "
+                   << "within maxEventMemory, all events of " << _file
+                   << " were read into memory" << std::endl;
+
+        _numChunks = (memory + maxEventMemory - 1) / maxEventMemory;
+        _chunkSize = (_numEvents + _numChunks - 1) / _numChunks;
+        _numChunks = (_numEvents + _chunkSize - 1) / _chunkSize;
+        LBINFO << "Loading " << _numEvents << " events in " << _numChunks
+               << " chunks of " << _chunkSize << " events" << std::endl;
     }
 
-    ssize_t load()
+    ssize_t load(const size_t chunkIndex, const size_t numChunks)
     {
+        const size_t first = chunkIndex * _chunkSize;
+        if (_numChunks > 1)
+        {
+            const size_t last =
+                std::min((chunkIndex + numChunks) * _chunkSize, _numEvents);
+            _output.selectEvents(first, last - first);
+        }
+
         const size_t numEvents = _output.getNumEvents();
         for (size_t i = 0; i < numEvents; ++i)
-            _output[i] = (i + 1 + _output.getCurrentTime());
+            _output[i] = (first + i + 1 + _output.getCurrentTime());
 
         return numEvents;
     }
 
     EventSource& _output;
     const std::string& _file;
+    size_t _numEvents;
+    size_t _numChunks;
+    size_t _chunkSize;
 };
 
 GenericLoader::GenericLoader(const URIHandler& params)
@@ -84,9 +124,13 @@ Vector2f GenericLoader::_getTimeRange() const
     return Vector2f(0.f, 100.f);
 }
 
-ssize_t GenericLoader::_load(const size_t /*chunkIndex*/,
-                             const size_t /*numChunks*/)
+ssize_t GenericLoader::_load(const size_t chunkIndex, const size_t numChunks)
+{
+    return _impl->load(chunkIndex, numChunks);
+}
+
+size_t GenericLoader::_getNumChunks() const
 {
-    return _impl->load();
+    return _impl->_numChunks;
 }
 }
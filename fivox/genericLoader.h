@@ -28,6 +28,9 @@ namespace fivox
 /**
  * Load a set of events from file, if specified. Otherwise, generate a set of
  * dummy events arranged in a vertical straight line.
+ *
+ * With the 'maxEventMemory' URI parameter, the events of the file are split
+ * into chunks in file order, each one loaded with EventSource::selectEvents().
  */
 class GenericLoader : public EventSource
 {
@@ -47,7 +50,7 @@ private:
     Vector2f _getTimeRange() const final;
     ssize_t _load(size_t chunkIndex, size_t numChunks) final;
     SourceType _getType() const final { return SourceType::frame; }
-    size_t _getNumChunks() const final { return 1; }
+    size_t _getNumChunks() const final;
     //@}
 
     class Impl;
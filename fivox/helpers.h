@@ -21,7 +21,12 @@
 #ifndef FIVOX_HELPERS_H
 #define FIVOX_HELPERS_H
 
+#include <fivox/eventGeometry.h>
 #include <fivox/eventSource.h>
+#include <fivox/kernels.h>
+#include <fivox/uriHandler.h>
+
+#include <brain/circuit.h>
 
 #include <brain/neuron/morphology.h>
 #include <brain/neuron/section.h>
@@ -31,6 +36,16 @@
 
 #include <lunchbox/log.h>
 
+#include <atomic>
+#include <cmath>
+#include <deque>
+#include <exception>
+#include <future>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
 namespace fivox
 {
 namespace helpers
@@ -76,7 +91,7 @@ inline FlatInverseMapping computeInverseMapping(
 }
 
 /**
- * Add one event per simulation compartment to the given event source.
+ * Create one event per simulation compartment.
  * The compartment counts are obtained from the report mapping. The event
  * positions are computed from the morphology list.
  *
@@ -84,78 +99,361 @@ inline FlatInverseMapping computeInverseMapping(
  *        index must correspond to the cell at the same index in the report
  *        mapping.
  * @param report The report from which the compartments per section are obtained
- * @param output The output event source. Events are added in the morphology
- *        iteration order, starting with the soma and then all the dendrites.
  * @param somasOnly Specify whether the events will be created for the somas
  *        only or for all the compartments. False by default (load all).
+ * @return the geometry of the events, in the morphology iteration order,
+ *         starting with the soma and then all the dendrites.
+ *
+ * The events of the cells are created in parallel, each cell by one thread,
+ * into the index ranges of their compartments in the report mapping.
  */
-inline void addCompartmentEvents(
+inline EventGeometryPtr createCompartmentEvents(
     const brain::neuron::Morphologies& morphologies,
-    const brion::CompartmentReport& report, EventSource& output,
-    const bool somasOnly = false)
+    const brion::CompartmentReport& report, const bool somasOnly = false)
 {
-    size_t size = 0;
     const auto& mapping = computeInverseMapping(report);
-    // first loop over the mapping to compute the number of elements
-    for (const auto& i : mapping)
-    {
-        size_t offset;
-        uint32_t cellIndex;
-        uint32_t sectionId;
-        uint16_t compartments;
-        std::tie(offset, cellIndex, sectionId, compartments) = i;
 
-        if (somasOnly && sectionId != 0)
-            continue;
-
-        size += compartments;
+    // the index of the first event of each element of the mapping
+    std::vector<size_t> firstEvents(mapping.size());
+    size_t size = 0;
+    for (size_t i = 0; i != mapping.size(); ++i)
+    {
+        firstEvents[i] = size;
+        if (!somasOnly || std::get<2>(mapping[i]) == 0)
+            size += std::get<3>(mapping[i]);
     }
-    output.resize(size);
+    auto output = std::make_shared<EventGeometry>(size);
 
-    size_t index = 0;
-    // second loop to add the actual events
-    for (const auto& i : mapping)
+    // the elements of each cell, so each morphology is used by one thread
+    const size_t numCells = morphologies.size();
+    std::vector<size_t> cellStart(numCells + 1, 0);
+    for (const auto& element : mapping)
+        ++cellStart[std::get<1>(element) + 1];
+    for (size_t i = 0; i != numCells; ++i)
+        cellStart[i + 1] += cellStart[i];
+    std::vector<size_t> cellElements(mapping.size());
     {
-        size_t offset;
-        uint32_t cellIndex;
-        uint32_t sectionId;
-        uint16_t compartments;
-        std::tie(offset, cellIndex, sectionId, compartments) = i;
+        std::vector<size_t> next(cellStart.begin(), cellStart.end() - 1);
+        for (size_t i = 0; i != mapping.size(); ++i)
+            cellElements[next[std::get<1>(mapping[i])]++] = i;
+    }
 
-        const auto& morphology = *morphologies[cellIndex];
+    std::atomic<size_t> nextCell(0);
+    std::mutex errorMutex;
+    std::exception_ptr error;
+    const auto fill = [&] {
+        // consecutive events of a cell, set with one range update
+        std::vector<float> posx, posy, posz, radii;
+        brion::floats samples;
+        size_t first = 0;
+        const auto add = [&](const Vector3f& position, const float radius) {
+            posx.push_back(position[0]);
+            posy.push_back(position[1]);
+            posz.push_back(position[2]);
+            radii.push_back(radius);
+        };
+        const auto flush = [&] {
+            if (!posx.empty())
+            {
+                output->update(first, posx.size(), posx.data(), posy.data(),
+                               posz.data(), radii.data());
+            }
+            first += posx.size();
+            posx.clear();
+            posy.clear();
+            posz.clear();
+            radii.clear();
+        };
 
-        if (sectionId == 0)
+        try
         {
-            const auto& soma = morphology.getSoma();
-            for (size_t k = 0; k != compartments; ++k)
-                output.update(index++, soma.getCentroid(),
-                              soma.getMeanRadius());
-            continue;
+            for (size_t cell = nextCell++; cell < numCells; cell = nextCell++)
+            {
+                const auto& morphology = *morphologies[cell];
+                for (size_t i = cellStart[cell]; i != cellStart[cell + 1]; ++i)
+                {
+                    const size_t element = cellElements[i];
+                    const uint32_t sectionId = std::get<2>(mapping[element]);
+                    const uint16_t compartments =
+                        std::get<3>(mapping[element]);
+                    if (somasOnly && sectionId != 0)
+                        continue;
+                    if (first + posx.size() != firstEvents[element])
+                    {
+                        flush();
+                        first = firstEvents[element];
+                    }
+
+                    if (sectionId == 0)
+                    {
+                        const auto& soma = morphology.getSoma();
+                        for (size_t k = 0; k != compartments; ++k)
+                            add(soma.getCentroid(), soma.getMeanRadius());
+                        continue;
+                    }
+
+                    // normalized compartment length, exactly one sample per
+                    // compartment
+                    const float normLength = 1.f / float(compartments);
+                    samples.resize(compartments);
+                    float k = normLength * .5f;
+                    for (size_t j = 0; j != compartments; ++j, k += normLength)
+                        samples[j] = k;
+
+                    const auto& neuronSection =
+                        morphology.getSection(sectionId);
+
+                    // actual compartment length
+                    const float compartmentLength =
+                        normLength * neuronSection.getLength();
+
+                    for (const auto& point : neuronSection.getSamples(samples))
+                    {
+                        add(point.get_sub_vector<3, 0>(),
+                            compartmentLength * .2f);
+                    }
+                }
+                flush();
+            }
         }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            error = std::current_exception();
+            nextCell = numCells;
+        }
+    };
 
-        if (somasOnly)
-            continue;
+    const size_t numThreads = std::max<size_t>(
+        1, std::min<size_t>(std::thread::hardware_concurrency(), numCells));
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < numThreads; ++i)
+        threads.emplace_back(fill);
+    fill();
+    for (auto& thread : threads)
+        thread.join();
+    if (error)
+        std::rethrow_exception(error);
+    return output;
+}
 
-        brion::floats samples;
-        samples.reserve(compartments);
-        // normalized compartment length
-        const float normLength = 1.f / float(compartments);
-        for (float k = normLength * .5f; k < 1.0; k += normLength)
-            samples.push_back(k);
+/**
+ * @return a hash of the given key and the compartments of the report, to
+ *         identify the events created from them in the geometry cache.
+ */
+inline uint64_t computeEventsKey(const std::string& key,
+                                 const brion::CompartmentReport& report)
+{
+    uint64_t hash = kernels::hashSeed;
+    const auto add = [&hash](const uint64_t value) {
+        hash = kernels::hashValue(value, hash);
+    };
+    for (const char c : key)
+        add(uint8_t(c));
+
+    const brion::SectionOffsets& offsets = report.getOffsets();
+    const brion::CompartmentCounts& counts = report.getCompartmentCounts();
+    for (size_t i = 0; i != offsets.size(); ++i)
+    {
+        add(offsets[i].size());
+        for (size_t j = 0; j != offsets[i].size(); ++j)
+        {
+            add(offsets[i][j]);
+            add(counts[i][j]);
+        }
+    }
+    return hash;
+}
+
+/** @return the 64 bit FNV-1a hash of all given GIDs, see computeEventsKey() */
+inline uint64_t computeGIDsHash(const brion::GIDSet& gids)
+{
+    uint64_t hash = kernels::hashSeed;
+    for (const uint32_t gid : gids)
+        hash = kernels::hashValue(gid, hash);
+    return hash;
+}
+
+/**
+ * @return the number of events created by createCompartmentEvents() for the
+ *         given report.
+ */
+inline size_t getNumCompartmentEvents(const brion::CompartmentReport& report,
+                                      const bool somasOnly)
+{
+    const brion::CompartmentCounts& counts = report.getCompartmentCounts();
+    size_t numEvents = 0;
+    for (const auto& sections : counts)
+        for (size_t i = 0; i != sections.size(); ++i)
+            if (!somasOnly || i == 0)
+                numEvents += sections[i];
+    return numEvents;
+}
 
-        const auto& neuronSection = morphology.getSection(sectionId);
+/**
+ * Set one event per simulation compartment in the given event source, see
+ * createCompartmentEvents().
+ *
+ * The events are shared with all other sources in the process for the same
+ * circuit, cells and report, so the morphologies are loaded only once, and
+ * stored in the directory of URIHandler::getGeometryCache() for later runs.
+ * The events are in report order, or sorted if requested by the parameters,
+ * in which case event i is at index EventGeometry::getOrder()[i] in report
+ * order.
+ *
+ * @param params the circuit and cells to load.
+ * @param report The report from which the compartments per section are obtained
+ * @param output The output event source.
+ * @param somasOnly Specify whether the events will be created for the somas
+ *        only or for all the compartments. False by default (load all).
+ */
+inline void addCompartmentEvents(const URIHandler& params,
+                                 const brion::CompartmentReport& report,
+                                 EventSource& output,
+                                 const bool somasOnly = false)
+{
+    const brion::GIDSet& gids = params.getGIDs();
+    const size_t numEvents = getNumCompartmentEvents(report, somasOnly);
 
-        // actual compartment length
-        const float compartmentLength = normLength * neuronSection.getLength();
+    // the report determines the number of compartments per section
+    std::ostringstream key;
+    key << params.getConfigPath() << ":" << params.getReport() << ":"
+        << report.getBufferSize() << ":" << gids.size() << ":" << std::hex
+        << computeGIDsHash(gids) << (somasOnly ? ":somas" : "")
+        << (params.getSortEvents() ? ":sorted" : "");
 
-        const auto& points = neuronSection.getSamples(samples);
-        for (const auto& point : points)
+    // the events key also covers the report offsets and compartment counts
+    const uint64_t eventsKey = computeEventsKey(key.str(), report);
+    key << ":" << eventsKey;
+
+    const auto load = [&]() -> ConstEventGeometryPtr {
+        const std::string& cacheDir = params.getGeometryCache();
+        std::string filename;
+        if (!cacheDir.empty())
         {
-            output.update(index++, point.get_sub_vector<3, 0>(),
-                          compartmentLength * .2f);
+            std::ostringstream name;
+            name << cacheDir << "/" << std::hex << eventsKey << ".events";
+            filename = name.str();
+            ConstEventGeometryPtr events =
+                EventGeometry::read(filename, eventsKey);
+            if (events && events->getNumEvents() == numEvents)
+            {
+                LBINFO << "Mapped " << events->getNumEvents()
+                       << " events from " << filename << std::endl;
+                return events;
+            }
         }
+
+        LBINFO << "Loading " << gids.size() << " morphologies..." << std::endl;
+        const brain::Circuit circuit(params.getConfig());
+        const auto morphologies =
+            circuit.loadMorphologies(gids, brain::Circuit::Coordinates::global);
+
+        LBINFO << "Creating events..." << std::endl;
+        auto events = createCompartmentEvents(morphologies, report, somasOnly);
+        if (params.getSortEvents())
+            events->sortSpatially();
+
+        if (!filename.empty() && !events->write(filename, eventsKey))
+            LBWARN << "Could not write events to " << filename << std::endl;
+        return events;
+    };
+
+    ConstEventGeometryPtr events = EventGeometry::getShared(key.str(), load);
+    if (events->getNumEvents() != numEvents)
+    {
+        LBWARN << "Shared events of " << key.str() << " do not match the "
+               << "report, creating them again" << std::endl;
+        events = load();
     }
+    output.setGeometry(events);
 }
+
+/**
+ * Loads the frames of a compartment report, and reads the next frames in the
+ * background while the current one is voxelized.
+ *
+ * Within the frame window of the source, see EventSource::setFrameWindow(),
+ * up to the given number of frames are read ahead, which the report reads
+ * one after the other. Outside of it, the next frame is read while the
+ * requested times follow a constant stride, starting with the timestep of
+ * the report, so random accesses do not queue reads of unused frames.
+ */
+class FramePrefetcher
+{
+public:
+    FramePrefetcher(const brion::CompartmentReport& report,
+                    const size_t readAhead)
+        : _report(report)
+        , _readAhead(readAhead)
+        , _lastTime(std::numeric_limits<double>::quiet_NaN())
+        , _stride(report.getTimestep())
+    {
+    }
+
+    /**
+     * @return the frame at the current time of the source, or nullptr if
+     *         out of range.
+     */
+    brion::floatsPtr load(const EventSource& source)
+    {
+        const double time = source.getCurrentTime();
+        const double tolerance = _report.getTimestep() * 0.5;
+
+        // frames before the requested one are not used anymore
+        while (!_next.empty() &&
+               !(std::abs(_next.front().first - time) < tolerance))
+        {
+            _next.pop_front();
+        }
+
+        brion::floatsPtr frame;
+        if (_next.empty())
+            frame = _report.loadFrame(time).get();
+        else
+        {
+            frame = _next.front().second.get();
+            _next.pop_front();
+        }
+
+        // true for the first request, compared with NaN
+        const double stride = time - _lastTime;
+        const bool inSequence = !(std::abs(stride - _stride) >= tolerance);
+        if (std::abs(stride) >= tolerance)
+            _stride = stride;
+        _lastTime = time;
+        if (!frame)
+            return frame;
+
+        const double dt = source.getDt();
+        const Vector2ui& window = source.getFrameWindow();
+        const double current = std::round(time / dt);
+        if (current >= window[0] && current < window[1])
+        {
+            // the queued frames follow the current one
+            const double end = std::min<double>(window[1],
+                                                current + 1 + _readAhead);
+            for (double i = current + 1 + _next.size(); i < end; ++i)
+                _queue(dt * i);
+        }
+        else if (inSequence && _next.empty())
+            _queue(time + _stride);
+        return frame;
+    }
+
+private:
+    const brion::CompartmentReport& _report;
+    const size_t _readAhead;
+    std::deque<std::pair<double, std::future<brion::floatsPtr>>> _next;
+    double _lastTime;
+    double _stride; // between the last two different requested times
+
+    void _queue(const double time)
+    {
+        if (time >= _report.getStartTime() && time < _report.getEndTime())
+            _next.emplace_back(time, _report.loadFrame(time));
+    }
+};
 }
 }
 #endif
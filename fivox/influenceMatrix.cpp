@@ -0,0 +1,420 @@
+/* Copyright (c) 2017, EPFL/Blue Brain Project
+ *
+ * This file is part of Fivox <https://github.com/BlueBrain/Fivox>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "influenceMatrix.h"
+#include "eventGeometry.h"
+#include "eventSource.h"
+#include "kernels.h"
+
+#include <lunchbox/log.h>
+#include <lunchbox/memoryMap.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+
+#include <unistd.h>
+
+namespace fivox
+{
+namespace
+{
+const uint32_t _magic = 0xf1b0c5a1;
+const uint32_t _version = 1;
+
+/** Layout of a matrix file, followed by the offsets, columns and weights */
+struct Header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t hash;
+    uint64_t numNonZeros;
+    float origin[3];
+    float spacing[3];
+    uint32_t size[3];
+    uint32_t padding; // 8 byte alignment of the row offsets
+};
+
+size_t _getNumRows(const Vector3ui& size)
+{
+    return size_t(size[0]) * size[1] * size[2];
+}
+
+size_t _getFileSize(const size_t numRows, const size_t numNonZeros)
+{
+    return sizeof(Header) + (numRows + 1) * sizeof(uint64_t) +
+           numNonZeros * (sizeof(uint32_t) + sizeof(float));
+}
+
+/**
+ * Call func(row, event, weight) for all voxels within the cutoff distance of
+ * each event, with increasing event indices for each row.
+ *
+ * The voxels are visited one XY plane at a time, so the rows written by func
+ * stay in cache.
+ */
+template <typename F>
+void _forEachWeight(const EventSource& source, const Vector3f& origin,
+                    const Vector3f& spacing, const Vector3ui& size,
+                    const F& func)
+{
+    const float* posx = source.getPositionsX();
+    const float* posy = source.getPositionsY();
+    const float* posz = source.getPositionsZ();
+    const float* radii = source.getRadii();
+    const float cutOffDistance = source.getCutOffDistance();
+    const float cutOffDistance2 = cutOffDistance * cutOffDistance;
+    const size_t numEvents = source.getNumEvents();
+
+    // box of voxels within the cutoff distance of each event, clamped in
+    // floating point for events far off the volume
+    std::vector<Vector3ui> begins(numEvents);
+    std::vector<Vector3ui> ends(numEvents);
+    std::vector<uint32_t> numStarts(size[2] + 1, 0);
+    for (size_t i = 0; i < numEvents; ++i)
+    {
+        const Vector3f position(posx[i], posy[i], posz[i]);
+        for (size_t j = 0; j < 3; ++j)
+        {
+            const float lower = std::max(
+                std::ceil((position[j] - cutOffDistance - origin[j]) /
+                          spacing[j]),
+                0.f);
+            const float upper = std::min(
+                std::floor((position[j] + cutOffDistance - origin[j]) /
+                           spacing[j]) +
+                    1.f,
+                float(size[j]));
+            const bool isEmpty = !(lower < upper);
+            begins[i][j] = isEmpty ? 0 : unsigned(lower);
+            ends[i][j] = isEmpty ? 0 : unsigned(upper);
+        }
+        if (begins[i][0] < ends[i][0] && begins[i][1] < ends[i][1] &&
+            begins[i][2] < ends[i][2])
+        {
+            ++numStarts[begins[i][2] + 1];
+        }
+    }
+
+    // events sorted by their first plane, with increasing indices
+    for (size_t z = 0; z < size[2]; ++z)
+        numStarts[z + 1] += numStarts[z];
+    std::vector<uint32_t> starts(numStarts.back());
+    {
+        std::vector<uint32_t> next(numStarts.begin(), numStarts.end() - 1);
+        for (size_t i = 0; i < numEvents; ++i)
+            if (begins[i][0] < ends[i][0] && begins[i][1] < ends[i][1] &&
+                begins[i][2] < ends[i][2])
+            {
+                starts[next[begins[i][2]]++] = i;
+            }
+    }
+
+    std::vector<uint32_t> active;
+    std::vector<uint32_t> merged;
+    for (size_t z = 0; z < size[2]; ++z)
+    {
+        // add the events starting on this plane, keeping the indices sorted
+        merged.clear();
+        std::merge(active.begin(), active.end(),
+                   starts.begin() + numStarts[z],
+                   starts.begin() + numStarts[z + 1],
+                   std::back_inserter(merged));
+        active.swap(merged);
+
+        const float dz = origin[2] + z * spacing[2];
+        for (const uint32_t i : active)
+        {
+            const float invRadius = radii[i];
+            const float eventDz = dz - posz[i];
+            for (size_t y = begins[i][1]; y < ends[i][1]; ++y)
+            {
+                const float dy = origin[1] + y * spacing[1] - posy[i];
+                const size_t row = size[0] * (y + size[1] * z);
+                for (size_t x = begins[i][0]; x < ends[i][0]; ++x)
+                {
+                    const float dx = origin[0] + x * spacing[0] - posx[i];
+                    const float distance2 =
+                        dx * dx + dy * dy + eventDz * eventDz;
+                    if (distance2 > cutOffDistance2)
+                        continue;
+
+                    // clamped within the radius, as in the FieldFunctor
+                    const float invDistance2 = 1.f / distance2;
+                    func(row + x, i, invDistance2 > invRadius * invRadius
+                                         ? invRadius
+                                         : invDistance2);
+                }
+            }
+        }
+
+        // remove the events ending on this plane
+        active.erase(std::remove_if(active.begin(), active.end(),
+                                    [&ends, z](const uint32_t i) {
+                                        return ends[i][2] == z + 1;
+                                    }),
+                     active.end());
+    }
+}
+}
+
+class InfluenceMatrix::Impl
+{
+public:
+    Impl()
+        : hash(0)
+        , numRows(0)
+        , numNonZeros(0)
+        , offsets(nullptr)
+        , columns(nullptr)
+        , weights(nullptr)
+    {
+    }
+
+    void setGeometry(const uint64_t hash_, const Vector3f& origin_,
+                     const Vector3f& spacing_, const Vector3ui& size_)
+    {
+        hash = hash_;
+        origin = origin_;
+        spacing = spacing_;
+        size = size_;
+        numRows = _getNumRows(size);
+    }
+
+    void setFile(void* data)
+    {
+        uint8_t* ptr = reinterpret_cast<uint8_t*>(data) + sizeof(Header);
+        offsets = reinterpret_cast<uint64_t*>(ptr);
+        ptr += (numRows + 1) * sizeof(uint64_t);
+        columns = reinterpret_cast<uint32_t*>(ptr);
+        ptr += numNonZeros * sizeof(uint32_t);
+        weights = reinterpret_cast<float*>(ptr);
+    }
+
+    uint64_t hash;
+    Vector3f origin;
+    Vector3f spacing;
+    Vector3ui size;
+    size_t numRows;
+    size_t numNonZeros;
+
+    // point to either the vectors or the mapped file
+    uint64_t* offsets;
+    uint32_t* columns;
+    float* weights;
+
+    std::vector<uint64_t> offsetsData;
+    std::vector<uint32_t> columnsData;
+    std::vector<float> weightsData;
+    lunchbox::MemoryMap file;
+};
+
+InfluenceMatrix::InfluenceMatrix()
+    : _impl(new Impl)
+{
+}
+
+InfluenceMatrix::~InfluenceMatrix()
+{
+}
+
+uint64_t InfluenceMatrix::computeHash(const EventSource& source)
+{
+    const float cutOffDistance = source.getCutOffDistance();
+    return kernels::hashWords(&cutOffDistance, 1,
+                              source.getGeometry()->computeHash());
+}
+
+bool InfluenceMatrix::build(const EventSource& source, const Vector3f& origin,
+                            const Vector3f& spacing, const Vector3ui& size,
+                            const std::string& filename)
+{
+    clear();
+    const uint64_t hash = computeHash(source);
+    const size_t numRows = _getNumRows(size);
+
+    // count the weights of each row first, to store them contiguously
+    std::vector<uint64_t> offsets(numRows + 1, 0);
+    _forEachWeight(source, origin, spacing, size,
+                   [&offsets](const size_t row, uint32_t, float) {
+                       ++offsets[row + 1];
+                   });
+    for (size_t i = 0; i < numRows; ++i)
+        offsets[i + 1] += offsets[i];
+    const size_t numNonZeros = offsets.back();
+
+    _impl->setGeometry(hash, origin, spacing, size);
+    _impl->numNonZeros = numNonZeros;
+
+    // the file is complete before it is renamed to its name, so crashed or
+    // concurrent builds never leave a partial matrix behind for map()
+    bool written = false;
+    const std::string temporary =
+        filename + "." + std::to_string(::getpid()) + ".tmp";
+    if (!filename.empty())
+    {
+        void* data =
+            _impl->file.create(temporary, _getFileSize(numRows, numNonZeros));
+        if (data)
+        {
+            Header* header = reinterpret_cast<Header*>(data);
+            header->magic = _magic;
+            header->version = _version;
+            header->hash = hash;
+            header->numNonZeros = numNonZeros;
+            for (size_t i = 0; i < 3; ++i)
+            {
+                header->origin[i] = origin[i];
+                header->spacing[i] = spacing[i];
+                header->size[i] = size[i];
+            }
+            header->padding = 0;
+            _impl->setFile(data);
+            ::memcpy(_impl->offsets, offsets.data(),
+                     offsets.size() * sizeof(uint64_t));
+            written = true;
+        }
+        else
+        {
+            LBWARN << "Cannot write influence matrix to " << filename
+                   << ", keeping it in memory" << std::endl;
+            ::unlink(temporary.c_str());
+        }
+    }
+
+    if (!written)
+    {
+        _impl->offsetsData.swap(offsets);
+        _impl->columnsData.resize(numNonZeros);
+        _impl->weightsData.resize(numNonZeros);
+        _impl->offsets = _impl->offsetsData.data();
+        _impl->columns = _impl->columnsData.data();
+        _impl->weights = _impl->weightsData.data();
+    }
+
+    std::vector<uint64_t> next(_impl->offsets, _impl->offsets + numRows);
+    uint32_t* columns = _impl->columns;
+    float* weights = _impl->weights;
+    _forEachWeight(source, origin, spacing, size,
+                   [&](const size_t row, const uint32_t event,
+                       const float weight) {
+                       const uint64_t index = next[row]++;
+                       columns[index] = event;
+                       weights[index] = weight;
+                   });
+
+    // the mapping stays valid if the file is renamed or removed
+    if (written && ::rename(temporary.c_str(), filename.c_str()) != 0)
+    {
+        LBWARN << "Cannot write influence matrix to " << filename
+               << ", keeping it in memory" << std::endl;
+        ::unlink(temporary.c_str());
+        written = false;
+    }
+
+    LBINFO << "Built influence matrix of " << numRows << " voxels and "
+           << source.getNumEvents() << " events with " << numNonZeros
+           << " weights" << std::endl;
+    return filename.empty() || written;
+}
+
+bool InfluenceMatrix::map(const std::string& filename, const uint64_t hash,
+                          const Vector3f& origin, const Vector3f& spacing,
+                          const Vector3ui& size)
+{
+    clear();
+    const void* data = _impl->file.map(filename);
+    if (!data || _impl->file.getSize() < sizeof(Header))
+    {
+        _impl->file.unmap();
+        return false;
+    }
+
+    const Header* header = reinterpret_cast<const Header*>(data);
+    const size_t numRows = _getNumRows(size);
+    bool matches = header->magic == _magic && header->version == _version &&
+                   header->hash == hash &&
+                   _impl->file.getSize() ==
+                       _getFileSize(numRows, header->numNonZeros);
+    for (size_t i = 0; i < 3; ++i)
+    {
+        matches = matches && header->origin[i] == origin[i] &&
+                  header->spacing[i] == spacing[i] &&
+                  header->size[i] == size[i];
+    }
+    if (!matches)
+    {
+        LBINFO << "Influence matrix " << filename
+               << " was built for other events or voxels" << std::endl;
+        _impl->file.unmap();
+        return false;
+    }
+
+    _impl->setGeometry(hash, origin, spacing, size);
+    _impl->numNonZeros = header->numNonZeros;
+    // the mapping is read-only, the pointers are only read through const
+    // methods
+    _impl->setFile(const_cast<void*>(data));
+    LBINFO << "Mapped influence matrix " << filename << " with "
+           << _impl->numNonZeros << " weights" << std::endl;
+    return true;
+}
+
+void InfluenceMatrix::clear()
+{
+    _impl->file.unmap();
+    std::vector<uint64_t>().swap(_impl->offsetsData);
+    std::vector<uint32_t>().swap(_impl->columnsData);
+    std::vector<float>().swap(_impl->weightsData);
+    _impl->offsets = nullptr;
+    _impl->columns = nullptr;
+    _impl->weights = nullptr;
+    _impl->numRows = 0;
+    _impl->numNonZeros = 0;
+}
+
+bool InfluenceMatrix::isValid(const uint64_t hash, const Vector3f& origin,
+                              const Vector3f& spacing,
+                              const Vector3ui& size) const
+{
+    return _impl->offsets && _impl->hash == hash && _impl->origin == origin &&
+           _impl->spacing == spacing && _impl->size == size;
+}
+
+size_t InfluenceMatrix::getNumNonZeros() const
+{
+    return _impl->numNonZeros;
+}
+
+void InfluenceMatrix::multiply(const float* values, float* output) const
+{
+    const uint64_t* offsets = _impl->offsets;
+    const uint32_t* columns = _impl->columns;
+    const float* weights = _impl->weights;
+
+    for (size_t row = 0; row < _impl->numRows; ++row)
+    {
+        float value = 0.f;
+        for (uint64_t i = offsets[row]; i < offsets[row + 1]; ++i)
+            value += weights[i] * values[columns[i]];
+        output[row] = value;
+    }
+}
+}
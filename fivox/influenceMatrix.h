@@ -0,0 +1,107 @@
+/* Copyright (c) 2017, EPFL/Blue Brain Project
+ *
+ * This file is part of Fivox <https://github.com/BlueBrain/Fivox>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef FIVOX_INFLUENCEMATRIX_H
+#define FIVOX_INFLUENCEMATRIX_H
+
+#include <fivox/api.h>
+#include <fivox/types.h>
+
+#include <memory> // member
+
+namespace fivox
+{
+/**
+ * Sparse matrix of the field weights of the events on a box of voxels.
+ *
+ * The field of the FieldFunctor is linear in the event values, so for events
+ * which do not move, each frame is the product of this matrix with the
+ * values. The matrix is stored in CSR format, with one row per voxel (X
+ * fastest) and the indices of the events within the cutoff distance as
+ * columns. It can be written to a file and memory-mapped from there.
+ */
+class InfluenceMatrix
+{
+public:
+    FIVOX_API InfluenceMatrix();
+    FIVOX_API ~InfluenceMatrix();
+
+    /**
+     * @return a hash of the number, positions and radii of the events and of
+     *         the cutoff distance of the source, which identifies the events
+     *         a matrix was built for.
+     */
+    FIVOX_API static uint64_t computeHash(const EventSource& source);
+
+    /**
+     * (Re)build the matrix for the current events of the given source.
+     *
+     * @param source the events.
+     * @param origin the position of the first voxel.
+     * @param spacing the distance between voxels along each dimension.
+     * @param size the number of voxels along each dimension.
+     * @param filename the file to write the matrix to and to map it from, or
+     *        empty to keep it in memory. The file is written under a
+     *        temporary name and renamed once complete.
+     * @return false if the file could not be written.
+     */
+    FIVOX_API bool build(const EventSource& source, const Vector3f& origin,
+                         const Vector3f& spacing, const Vector3ui& size,
+                         const std::string& filename = std::string());
+
+    /**
+     * Map a matrix written by build().
+     *
+     * @param filename the matrix file.
+     * @param hash the hash of the events, see computeHash().
+     * @return false if the file does not exist, or was built for other
+     *         events or voxels.
+     */
+    FIVOX_API bool map(const std::string& filename, uint64_t hash,
+                       const Vector3f& origin, const Vector3f& spacing,
+                       const Vector3ui& size);
+
+    /** Release all memory, isValid() returns false afterwards. */
+    FIVOX_API void clear();
+
+    /** @return true if the matrix was built for the given events and voxels. */
+    FIVOX_API bool isValid(uint64_t hash, const Vector3f& origin,
+                           const Vector3f& spacing,
+                           const Vector3ui& size) const;
+
+    /** @return the number of stored weights. */
+    FIVOX_API size_t getNumNonZeros() const;
+
+    /**
+     * Compute the field of the given event values.
+     *
+     * @param values the value of each event, as from EventSource::getValues().
+     * @param output one value per voxel, with X fastest.
+     */
+    FIVOX_API void multiply(const float* values, float* output) const;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> _impl;
+
+    InfluenceMatrix(const InfluenceMatrix&) = delete;
+    InfluenceMatrix& operator=(const InfluenceMatrix&) = delete;
+};
+}
+
+#endif
@@ -0,0 +1,95 @@
+/* Copyright (c) 2017, EPFL/Blue Brain Project
+ *
+ * This file is part of Fivox <https://github.com/BlueBrain/Fivox>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef FIVOX_INFLUENCEMATRIXIMAGESOURCE_H
+#define FIVOX_INFLUENCEMATRIXIMAGESOURCE_H
+
+#include <fivox/imageSource.h>
+#include <fivox/influenceMatrix.h> // member
+#include <fivox/types.h>
+
+#include <memory>
+
+namespace fivox
+{
+/**
+ * Image source computing the field of the FieldFunctor as the product of an
+ * InfluenceMatrix with the event values.
+ *
+ * Each thread builds the matrix of its region of the volume on the first
+ * update, and multiplies it with the values of each following frame.
+ * The matrices are rebuilt when the number, positions or radii of the events
+ * or the volume change, so this is only faster for events which do not move,
+ * e.g. compartments, somas and VSD.
+ */
+template <typename TImage>
+class InfluenceMatrixImageSource : public ImageSource<TImage>
+{
+public:
+    /** Standard class typedefs. */
+    typedef InfluenceMatrixImageSource Self;
+    typedef ImageSource<TImage> Superclass;
+    typedef itk::SmartPointer<Self> Pointer;
+    typedef itk::SmartPointer<const Self> ConstPointer;
+
+    /** Method for creation through the object factory. */
+    itkNewMacro(Self)
+
+        /** Run-time type information (and related methods). */
+        itkTypeMacro(InfluenceMatrixImageSource, ImageSource)
+
+        /**
+         * Set the prefix of the files to store the matrices in, instead of
+         * memory. Matrices found in these files are reused if they were built
+         * for the same events and voxels.
+         */
+        void setFilename(const std::string& prefix);
+
+    /** @return the prefix of the matrix files, empty for in-memory. */
+    const std::string& getFilename() const;
+
+protected:
+    InfluenceMatrixImageSource();
+    virtual ~InfluenceMatrixImageSource() {}
+    InfluenceMatrixImageSource(const InfluenceMatrixImageSource&) = delete;
+    void operator=(const InfluenceMatrixImageSource&) = delete;
+
+    const itk::ImageRegionSplitterBase* GetImageRegionSplitter() const override
+    {
+        return _splitter;
+    }
+
+    void ThreadedGenerateData(
+        const typename Superclass::ImageRegionType& outputRegionForThread,
+        itk::ThreadIdType threadId) override;
+
+    void BeforeThreadedGenerateData() override;
+
+private:
+    std::string _filename;
+    uint64_t _hash;
+    std::vector<std::unique_ptr<InfluenceMatrix>> _matrices;
+    itk::ImageRegionSplitterBase::Pointer _splitter;
+};
+
+} // end namespace fivox
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "influenceMatrixImageSource.hxx"
+#endif
+#endif
@@ -0,0 +1,140 @@
+/* Copyright (c) 2017, EPFL/Blue Brain Project
+ *
+ * This file is part of Fivox <https://github.com/BlueBrain/Fivox>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef FIVOX_INFLUENCEMATRIXIMAGESOURCE_HXX
+#define FIVOX_INFLUENCEMATRIXIMAGESOURCE_HXX
+
+#include "influenceMatrixImageSource.h"
+#include "eventSource.h"
+
+#include <itkImageRegionIterator.h>
+#include <itkImageRegionSplitterDirection.h>
+#include <itkProgressReporter.h>
+
+namespace fivox
+{
+
+template< typename TImage >
+InfluenceMatrixImageSource< TImage >::InfluenceMatrixImageSource()
+    : ImageSource< TImage >()
+    , _hash( 0 )
+{
+    // one matrix per thread region, which are split like in the
+    // FunctorImageSource
+    itk::ImageRegionSplitterDirection::Pointer splitter =
+        itk::ImageRegionSplitterDirection::New();
+    splitter->SetDirection( 2 );
+    _splitter = splitter;
+}
+
+template< typename TImage >
+void InfluenceMatrixImageSource< TImage >::setFilename(
+    const std::string& prefix )
+{
+    _filename = prefix;
+    this->Modified();
+}
+
+template< typename TImage >
+const std::string& InfluenceMatrixImageSource< TImage >::getFilename() const
+{
+    return _filename;
+}
+
+template< typename TImage >
+void InfluenceMatrixImageSource< TImage >::BeforeThreadedGenerateData()
+{
+    auto source = Superclass::_eventSource;
+    const ssize_t updatedEvents = source->load();
+    const float time = source->getCurrentTime();
+    if( updatedEvents < 0 )
+    {
+        LBERROR << "Timestamp " << time << "ms not loaded, no data or events"
+                << std::endl;
+    }
+    else
+    {
+        LBINFO << "Timestamp " << time << "ms loaded, updated " << updatedEvents
+               << " event(s)" << std::endl;
+    }
+
+    _hash = InfluenceMatrix::computeHash( *source );
+    _matrices.resize( this->GetNumberOfThreads( ));
+    Superclass::_progressObserver->reset();
+}
+
+template< typename TImage >
+void InfluenceMatrixImageSource< TImage >::ThreadedGenerateData(
+    const typename Superclass::ImageRegionType& outputRegionForThread,
+    const itk::ThreadIdType threadId )
+{
+    itk::ProgressReporter progress( this, threadId, 1 );
+
+    typename Superclass::ImagePointer image = Superclass::GetOutput();
+    typename TImage::PointType point;
+    image->TransformIndexToPhysicalPoint( outputRegionForThread.GetIndex(),
+                                          point );
+    Vector3f origin, spacing;
+    Vector3ui size;
+    for( size_t i = 0; i < 3; ++i )
+    {
+        origin[i] = point[i];
+        spacing[i] = image->GetSpacing()[i];
+        size[i] = outputRegionForThread.GetSize()[i];
+    }
+
+    std::unique_ptr< InfluenceMatrix >& matrix = _matrices[threadId];
+    if( !matrix )
+        matrix.reset( new InfluenceMatrix );
+
+    const EventSource& source = *Superclass::_eventSource;
+    if( !matrix->isValid( _hash, origin, spacing, size ))
+    {
+        std::string filename;
+        if( !_filename.empty( ))
+        {
+            // one file per region, named after its voxel range
+            const auto& index = outputRegionForThread.GetIndex();
+            filename = _filename;
+            for( size_t i = 0; i < 3; ++i )
+                filename += "_" + std::to_string( index[i] ) + "-" +
+                            std::to_string( index[i] + size[i] );
+            filename += ".fvm";
+        }
+        if( filename.empty() ||
+            !matrix->map( filename, _hash, origin, spacing, size ))
+        {
+            matrix->build( source, origin, spacing, size, filename );
+        }
+    }
+
+    std::vector< float > tile( size_t( size[0] ) * size[1] * size[2] );
+    matrix->multiply( source.getValues(), tile.data( ));
+
+    itk::ImageRegionIterator< TImage > i( image, outputRegionForThread );
+    for( const float value : tile )
+    {
+        i.Set( value );
+        ++i;
+    }
+    progress.CompletedPixel();
+}
+
+} // end namespace fivox
+
+#endif
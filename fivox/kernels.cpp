@@ -0,0 +1,891 @@
+/* Copyright (c) 2017, EPFL/Blue Brain Project
+ *
+ * This file is part of Fivox <https://github.com/BlueBrain/Fivox>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "kernels.h"
+
+#include <lunchbox/debug.h>
+#include <lunchbox/log.h>
+
+#include <cfloat>
+#include <cmath>
+
+// The SIMD kernels are compiled for their instruction set with the target
+// attribute, independent of the compiler flags of the library
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define FIVOX_USE_SIMD
+#define FIVOX_TARGET(isa) __attribute__((target(isa)))
+#include <immintrin.h>
+#endif
+
+namespace fivox
+{
+namespace kernels
+{
+namespace
+{
+/** @return the field of an event, see sampleField(). */
+inline float _field(const float distance2, const float radius,
+                    const float value, const float squaredCutoff)
+{
+    // Comparisons are inverted, as we are using the reciprocal values
+    // (radius is already inverted from the loader)
+    if (distance2 < squaredCutoff)
+        return 0.f;
+    // If center of the voxel within the event radius, use the
+    // voltage at the surface of the compartment (at 'radius' distance)
+    if (distance2 > radius * radius)
+        return value * radius; // mV
+    return value * distance2;  // mV
+}
+
+/**
+ * Compute the voxels of a line within the cutoff sphere of an event, widened
+ * by one voxel on each side as the exact test is done per voxel.
+ *
+ * @param offset the distance along the line from the event to the first voxel.
+ * @param distance2 the squared distance of the event to the line.
+ */
+inline bool _getLineRange(const float offset, const float distance2,
+                          const float cutOffDistance2, const float invStep,
+                          const size_t size, size_t& begin, size_t& end)
+{
+    if (distance2 > cutOffDistance2)
+        return false;
+
+    const float halfWidth = std::sqrt(cutOffDistance2 - distance2);
+    const float center = -offset * invStep;
+    const float extent = halfWidth * invStep;
+    begin = std::min(float(size), std::max(0.f, std::floor(center - extent)));
+    end = std::min(float(size), std::max(0.f, std::ceil(center + extent) + 1));
+    return begin < end;
+}
+
+float _sampleFieldScalar(const float* __restrict__ posx,
+                         const float* __restrict__ posy,
+                         const float* __restrict__ posz,
+                         const float* __restrict__ radii,
+                         const float* __restrict__ values, const size_t begin,
+                         const size_t end, const Vector3f& point,
+                         const float cutOffDistance)
+{
+    // Compute directly the inverted value to gain performance in the for loop
+    const float squaredCutoff = 1.f / (cutOffDistance * cutOffDistance);
+    const float px(point[0]), py(point[1]), pz(point[2]);
+    float voltage1(0.f), voltage2(0.f);
+
+    for (size_t i = begin; i < end; ++i)
+    {
+        const float distanceX = px - posx[i];
+        const float distanceY = py - posy[i];
+        const float distanceZ = pz - posz[i];
+
+        const float distance2(1.f /
+                              (distanceX * distanceX + distanceY * distanceY +
+                               distanceZ * distanceZ));
+
+        // see _field(), with separate sums to help the optimization
+        if (distance2 < squaredCutoff)
+            continue;
+
+        const float value(values[i]);
+        const float radius(radii[i]);
+        if (distance2 > radius * radius)
+            voltage1 += value * radius; // mV
+        else
+            voltage2 += value * distance2; // mV
+    }
+    return voltage1 + voltage2;
+}
+
+/** Add the field of one event to the voxels [begin, end) of a row. */
+typedef void (*AddFieldRow)(float offsetX, float distanceYZ2, float radius,
+                            float value, float step, float squaredCutoff,
+                            size_t begin, size_t end, float* output);
+
+void _addFieldRowScalar(const float offsetX, const float distanceYZ2,
+                        const float radius, const float value,
+                        const float step, const float squaredCutoff,
+                        const size_t begin, const size_t end,
+                        float* __restrict__ output)
+{
+    for (size_t j = begin; j < end; ++j)
+    {
+        const float distanceX = offsetX + j * step;
+        const float distance2(1.f / (distanceX * distanceX + distanceYZ2));
+        output[j] += _field(distance2, radius, value, squaredCutoff);
+    }
+}
+
+// The traversals are shared by all instruction sets, the wrappers compile
+// them for the target of their row kernel.
+template <AddFieldRow addRow>
+inline void _sampleFieldLine(const float* posx, const float* posy,
+                             const float* posz, const float* radii,
+                             const float* values, const size_t begin,
+                             const size_t end, const Vector3f& point,
+                             const float step, const size_t size,
+                             const float cutOffDistance, float* output)
+{
+    const float cutOffDistance2 = cutOffDistance * cutOffDistance;
+    const float squaredCutoff = 1.f / cutOffDistance2;
+    const float invStep = 1.f / step;
+
+    for (size_t i = begin; i < end; ++i)
+    {
+        const float offsetX = point[0] - posx[i];
+        const float distanceY = point[1] - posy[i];
+        const float distanceZ = point[2] - posz[i];
+        const float distanceYZ2 = distanceY * distanceY + distanceZ * distanceZ;
+        size_t voxelBegin, voxelEnd;
+        if (_getLineRange(offsetX, distanceYZ2, cutOffDistance2, invStep, size,
+                          voxelBegin, voxelEnd))
+        {
+            addRow(offsetX, distanceYZ2, radii[i], values[i], step,
+                   squaredCutoff, voxelBegin, voxelEnd, output);
+        }
+    }
+}
+
+template <AddFieldRow addRow>
+inline void _splatField(const float* posx, const float* posy,
+                        const float* posz, const float* radii,
+                        const float* values, const size_t begin,
+                        const size_t end, const Vector3f& origin,
+                        const Vector3f& spacing, const Vector3ui& size,
+                        const float cutOffDistance, float* output)
+{
+    const float cutOffDistance2 = cutOffDistance * cutOffDistance;
+    const float squaredCutoff = 1.f / cutOffDistance2;
+    const Vector3f invSpacing(1.f / spacing[0], 1.f / spacing[1],
+                              1.f / spacing[2]);
+
+    for (size_t i = begin; i < end; ++i)
+    {
+        const float offsetX = origin[0] - posx[i];
+        const float offsetY = origin[1] - posy[i];
+        const float offsetZ = origin[2] - posz[i];
+        size_t zBegin, zEnd;
+        if (!_getLineRange(offsetZ, 0.f, cutOffDistance2, invSpacing[2],
+                           size[2], zBegin, zEnd))
+        {
+            continue;
+        }
+
+        for (size_t z = zBegin; z < zEnd; ++z)
+        {
+            const float distanceZ = offsetZ + z * spacing[2];
+            const float distanceZ2 = distanceZ * distanceZ;
+            size_t yBegin, yEnd;
+            if (!_getLineRange(offsetY, distanceZ2, cutOffDistance2,
+                               invSpacing[1], size[1], yBegin, yEnd))
+            {
+                continue;
+            }
+
+            for (size_t y = yBegin; y < yEnd; ++y)
+            {
+                const float distanceY = offsetY + y * spacing[1];
+                const float distanceYZ2 = distanceY * distanceY + distanceZ2;
+                size_t xBegin, xEnd;
+                if (_getLineRange(offsetX, distanceYZ2, cutOffDistance2,
+                                  invSpacing[0], size[0], xBegin, xEnd))
+                {
+                    addRow(offsetX, distanceYZ2, radii[i], values[i],
+                           spacing[0], squaredCutoff, xBegin, xEnd,
+                           output + size[0] * (y + size[1] * z));
+                }
+            }
+        }
+    }
+}
+
+void _sampleFieldLineScalar(const float* posx, const float* posy,
+                            const float* posz, const float* radii,
+                            const float* values, const size_t begin,
+                            const size_t end, const Vector3f& point,
+                            const float step, const size_t size,
+                            const float cutOffDistance, float* output)
+{
+    _sampleFieldLine<_addFieldRowScalar>(posx, posy, posz, radii, values,
+                                         begin, end, point, step, size,
+                                         cutOffDistance, output);
+}
+
+void _splatFieldScalar(const float* posx, const float* posy,
+                       const float* posz, const float* radii,
+                       const float* values, const size_t begin,
+                       const size_t end, const Vector3f& origin,
+                       const Vector3f& spacing, const Vector3ui& size,
+                       const float cutOffDistance, float* output)
+{
+    _splatField<_addFieldRowScalar>(posx, posy, posz, radii, values, begin,
+                                    end, origin, spacing, size,
+                                    cutOffDistance, output);
+}
+
+inline int64_t _getLinearIndex(const int64_t x, const int64_t y,
+                               const int64_t z, const Vector3ui& size)
+{
+    return x + size[0] * (y + size[1] * z);
+}
+
+void _computeVoxelIndicesScalar(const float* __restrict__ posx,
+                                const float* __restrict__ posy,
+                                const float* __restrict__ posz,
+                                const size_t numEvents, const Vector3f& origin,
+                                const Vector3f& invSpacing,
+                                const Vector3ui& size,
+                                int64_t* __restrict__ indices)
+{
+    for (size_t i = 0; i < numEvents; ++i)
+    {
+        // round to the nearest voxel center, as itk::Image does
+        const float x =
+            std::floor((posx[i] - origin[0]) * invSpacing[0] + 0.5f);
+        const float y =
+            std::floor((posy[i] - origin[1]) * invSpacing[1] + 0.5f);
+        const float z =
+            std::floor((posz[i] - origin[2]) * invSpacing[2] + 0.5f);
+
+        if (x >= 0.f && x < size[0] && y >= 0.f && y < size[1] && z >= 0.f &&
+            z < size[2])
+        {
+            indices[i] =
+                _getLinearIndex(int64_t(x), int64_t(y), int64_t(z), size);
+        }
+        else
+            indices[i] = -1;
+    }
+}
+
+#ifdef FIVOX_USE_SIMD
+// The SIMD kernels replace the division by a reciprocal estimate with one
+// Newton-Raphson step, and the branches of _field() by masks. The squared
+// distance is clamped to stay finite for events on a voxel center.
+
+/* SSE4 */
+FIVOX_TARGET("sse4.1")
+inline __m128 _fieldSSE4(const __m128 distance2, const __m128 radius,
+                         const __m128 value, const __m128 squaredCutoff)
+{
+    const __m128 d = _mm_max_ps(distance2, _mm_set1_ps(FLT_MIN));
+    __m128 r = _mm_rcp_ps(d);
+    r = _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(2.f), _mm_mul_ps(d, r)));
+
+    const __m128 near = _mm_cmpgt_ps(r, _mm_mul_ps(radius, radius));
+    const __m128 field = _mm_mul_ps(value, _mm_blendv_ps(r, radius, near));
+    return _mm_and_ps(field, _mm_cmpge_ps(r, squaredCutoff));
+}
+
+FIVOX_TARGET("sse4.1")
+float _sampleFieldSSE4(const float* posx, const float* posy, const float* posz,
+                       const float* radii, const float* values,
+                       const size_t begin, const size_t end,
+                       const Vector3f& point, const float cutOffDistance)
+{
+    const __m128 px = _mm_set1_ps(point[0]);
+    const __m128 py = _mm_set1_ps(point[1]);
+    const __m128 pz = _mm_set1_ps(point[2]);
+    const __m128 squaredCutoff =
+        _mm_set1_ps(1.f / (cutOffDistance * cutOffDistance));
+
+    __m128 voltage = _mm_setzero_ps();
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4)
+    {
+        const __m128 dx = _mm_sub_ps(px, _mm_loadu_ps(posx + i));
+        const __m128 dy = _mm_sub_ps(py, _mm_loadu_ps(posy + i));
+        const __m128 dz = _mm_sub_ps(pz, _mm_loadu_ps(posz + i));
+        const __m128 distance2 =
+            _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                       _mm_mul_ps(dz, dz));
+        voltage = _mm_add_ps(voltage, _fieldSSE4(distance2,
+                                                 _mm_loadu_ps(radii + i),
+                                                 _mm_loadu_ps(values + i),
+                                                 squaredCutoff));
+    }
+
+    voltage = _mm_add_ps(voltage, _mm_movehl_ps(voltage, voltage));
+    voltage = _mm_add_ss(voltage, _mm_shuffle_ps(voltage, voltage, 1));
+    return _mm_cvtss_f32(voltage) +
+           _sampleFieldScalar(posx, posy, posz, radii, values, i, end, point,
+                              cutOffDistance);
+}
+
+FIVOX_TARGET("sse4.1")
+void _addFieldRowSSE4(const float offsetX, const float distanceYZ2,
+                      const float radius, const float value, const float step,
+                      const float squaredCutoff, const size_t begin,
+                      const size_t end, float* output)
+{
+    const __m128 offset = _mm_set1_ps(offsetX);
+    const __m128 yz2 = _mm_set1_ps(distanceYZ2);
+    const __m128 radii = _mm_set1_ps(radius);
+    const __m128 values = _mm_set1_ps(value);
+    const __m128 steps = _mm_set1_ps(step);
+    const __m128 cutoff = _mm_set1_ps(squaredCutoff);
+    const __m128 lanes = _mm_setr_ps(0.f, 1.f, 2.f, 3.f);
+
+    size_t j = begin;
+    for (; j + 4 <= end; j += 4)
+    {
+        const __m128 index = _mm_add_ps(_mm_set1_ps(float(j)), lanes);
+        const __m128 dx = _mm_add_ps(offset, _mm_mul_ps(index, steps));
+        const __m128 distance2 = _mm_add_ps(_mm_mul_ps(dx, dx), yz2);
+        _mm_storeu_ps(output + j,
+                      _mm_add_ps(_mm_loadu_ps(output + j),
+                                 _fieldSSE4(distance2, radii, values, cutoff)));
+    }
+    _addFieldRowScalar(offsetX, distanceYZ2, radius, value, step,
+                       squaredCutoff, j, end, output);
+}
+
+FIVOX_TARGET("sse4.1")
+void _sampleFieldLineSSE4(const float* posx, const float* posy,
+                          const float* posz, const float* radii,
+                          const float* values, const size_t begin,
+                          const size_t end, const Vector3f& point,
+                          const float step, const size_t size,
+                          const float cutOffDistance, float* output)
+{
+    _sampleFieldLine<_addFieldRowSSE4>(posx, posy, posz, radii, values, begin,
+                                       end, point, step, size, cutOffDistance,
+                                       output);
+}
+
+FIVOX_TARGET("sse4.1")
+void _splatFieldSSE4(const float* posx, const float* posy, const float* posz,
+                     const float* radii, const float* values,
+                     const size_t begin, const size_t end,
+                     const Vector3f& origin, const Vector3f& spacing,
+                     const Vector3ui& size, const float cutOffDistance,
+                     float* output)
+{
+    _splatField<_addFieldRowSSE4>(posx, posy, posz, radii, values, begin, end,
+                                  origin, spacing, size, cutOffDistance,
+                                  output);
+}
+
+FIVOX_TARGET("sse4.1")
+void _computeVoxelIndicesSSE4(const float* posx, const float* posy,
+                              const float* posz, const size_t numEvents,
+                              const Vector3f& origin,
+                              const Vector3f& invSpacing,
+                              const Vector3ui& size, int64_t* indices)
+{
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 ox = _mm_set1_ps(origin[0]);
+    const __m128 oy = _mm_set1_ps(origin[1]);
+    const __m128 oz = _mm_set1_ps(origin[2]);
+    const __m128 ix = _mm_set1_ps(invSpacing[0]);
+    const __m128 iy = _mm_set1_ps(invSpacing[1]);
+    const __m128 iz = _mm_set1_ps(invSpacing[2]);
+    const __m128 sx = _mm_set1_ps(size[0]);
+    const __m128 sy = _mm_set1_ps(size[1]);
+    const __m128 sz = _mm_set1_ps(size[2]);
+
+    size_t i = 0;
+    for (; i + 4 <= numEvents; i += 4)
+    {
+        const __m128 x = _mm_floor_ps(_mm_add_ps(
+            _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(posx + i), ox), ix), half));
+        const __m128 y = _mm_floor_ps(_mm_add_ps(
+            _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(posy + i), oy), iy), half));
+        const __m128 z = _mm_floor_ps(_mm_add_ps(
+            _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(posz + i), oz), iz), half));
+        const __m128 valid = _mm_and_ps(
+            _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(x, zero), _mm_cmplt_ps(x, sx)),
+                       _mm_and_ps(_mm_cmpge_ps(y, zero), _mm_cmplt_ps(y, sy))),
+            _mm_and_ps(_mm_cmpge_ps(z, zero), _mm_cmplt_ps(z, sz)));
+
+        alignas(16) int32_t cx[4], cy[4], cz[4];
+        _mm_store_si128((__m128i*)cx, _mm_cvttps_epi32(x));
+        _mm_store_si128((__m128i*)cy, _mm_cvttps_epi32(y));
+        _mm_store_si128((__m128i*)cz, _mm_cvttps_epi32(z));
+        const int mask = _mm_movemask_ps(valid);
+        for (size_t j = 0; j < 4; ++j)
+            indices[i + j] = (mask & (1 << j))
+                                 ? _getLinearIndex(cx[j], cy[j], cz[j], size)
+                                 : -1;
+    }
+    _computeVoxelIndicesScalar(posx + i, posy + i, posz + i, numEvents - i,
+                               origin, invSpacing, size, indices + i);
+}
+/* AVX2 */
+FIVOX_TARGET("avx2,fma")
+inline __m256 _fieldAVX2(const __m256 distance2, const __m256 radius,
+                         const __m256 value, const __m256 squaredCutoff)
+{
+    const __m256 d = _mm256_max_ps(distance2, _mm256_set1_ps(FLT_MIN));
+    __m256 r = _mm256_rcp_ps(d);
+    r = _mm256_mul_ps(r, _mm256_fnmadd_ps(d, r, _mm256_set1_ps(2.f)));
+
+    const __m256 near =
+        _mm256_cmp_ps(r, _mm256_mul_ps(radius, radius), _CMP_GT_OQ);
+    const __m256 field =
+        _mm256_mul_ps(value, _mm256_blendv_ps(r, radius, near));
+    return _mm256_and_ps(field, _mm256_cmp_ps(r, squaredCutoff, _CMP_GE_OQ));
+}
+
+/** @return the mask of the first n lanes, n < 8 */
+FIVOX_TARGET("avx2,fma")
+inline __m256i _getMaskAVX2(const size_t n)
+{
+    return _mm256_cmpgt_epi32(_mm256_set1_epi32(int(n)),
+                              _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+FIVOX_TARGET("avx2,fma")
+float _sampleFieldAVX2(const float* posx, const float* posy, const float* posz,
+                       const float* radii, const float* values,
+                       const size_t begin, const size_t end,
+                       const Vector3f& point, const float cutOffDistance)
+{
+    const __m256 px = _mm256_set1_ps(point[0]);
+    const __m256 py = _mm256_set1_ps(point[1]);
+    const __m256 pz = _mm256_set1_ps(point[2]);
+    const __m256 squaredCutoff =
+        _mm256_set1_ps(1.f / (cutOffDistance * cutOffDistance));
+
+    __m256 voltage = _mm256_setzero_ps();
+    for (size_t i = begin; i < end; i += 8)
+    {
+        // the masked loads of the last events return zero values
+        const __m256i mask = _getMaskAVX2(std::min<size_t>(end - i, 8));
+        const __m256 dx = _mm256_sub_ps(px, _mm256_maskload_ps(posx + i, mask));
+        const __m256 dy = _mm256_sub_ps(py, _mm256_maskload_ps(posy + i, mask));
+        const __m256 dz = _mm256_sub_ps(pz, _mm256_maskload_ps(posz + i, mask));
+        const __m256 distance2 = _mm256_fmadd_ps(
+            dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+        voltage = _mm256_add_ps(
+            voltage,
+            _fieldAVX2(distance2, _mm256_maskload_ps(radii + i, mask),
+                       _mm256_maskload_ps(values + i, mask), squaredCutoff));
+    }
+
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(voltage),
+                            _mm256_extractf128_ps(voltage, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+}
+
+FIVOX_TARGET("avx2,fma")
+void _addFieldRowAVX2(const float offsetX, const float distanceYZ2,
+                      const float radius, const float value, const float step,
+                      const float squaredCutoff, const size_t begin,
+                      const size_t end, float* output)
+{
+    const __m256 offset = _mm256_set1_ps(offsetX);
+    const __m256 yz2 = _mm256_set1_ps(distanceYZ2);
+    const __m256 radii = _mm256_set1_ps(radius);
+    const __m256 values = _mm256_set1_ps(value);
+    const __m256 steps = _mm256_set1_ps(step);
+    const __m256 cutoff = _mm256_set1_ps(squaredCutoff);
+    const __m256 lanes = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+
+    for (size_t j = begin; j < end; j += 8)
+    {
+        const __m256i mask = _getMaskAVX2(std::min<size_t>(end - j, 8));
+        const __m256 index = _mm256_add_ps(_mm256_set1_ps(float(j)), lanes);
+        const __m256 dx = _mm256_fmadd_ps(index, steps, offset);
+        const __m256 distance2 = _mm256_fmadd_ps(dx, dx, yz2);
+        _mm256_maskstore_ps(
+            output + j, mask,
+            _mm256_add_ps(_mm256_maskload_ps(output + j, mask),
+                          _fieldAVX2(distance2, radii, values, cutoff)));
+    }
+}
+
+FIVOX_TARGET("avx2,fma")
+void _sampleFieldLineAVX2(const float* posx, const float* posy,
+                          const float* posz, const float* radii,
+                          const float* values, const size_t begin,
+                          const size_t end, const Vector3f& point,
+                          const float step, const size_t size,
+                          const float cutOffDistance, float* output)
+{
+    _sampleFieldLine<_addFieldRowAVX2>(posx, posy, posz, radii, values, begin,
+                                       end, point, step, size, cutOffDistance,
+                                       output);
+}
+
+FIVOX_TARGET("avx2,fma")
+void _splatFieldAVX2(const float* posx, const float* posy, const float* posz,
+                     const float* radii, const float* values,
+                     const size_t begin, const size_t end,
+                     const Vector3f& origin, const Vector3f& spacing,
+                     const Vector3ui& size, const float cutOffDistance,
+                     float* output)
+{
+    _splatField<_addFieldRowAVX2>(posx, posy, posz, radii, values, begin, end,
+                                  origin, spacing, size, cutOffDistance,
+                                  output);
+}
+
+FIVOX_TARGET("avx2,fma")
+void _computeVoxelIndicesAVX2(const float* posx, const float* posy,
+                              const float* posz, const size_t numEvents,
+                              const Vector3f& origin,
+                              const Vector3f& invSpacing,
+                              const Vector3ui& size, int64_t* indices)
+{
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 ox = _mm256_set1_ps(origin[0]);
+    const __m256 oy = _mm256_set1_ps(origin[1]);
+    const __m256 oz = _mm256_set1_ps(origin[2]);
+    const __m256 ix = _mm256_set1_ps(invSpacing[0]);
+    const __m256 iy = _mm256_set1_ps(invSpacing[1]);
+    const __m256 iz = _mm256_set1_ps(invSpacing[2]);
+    const __m256 sx = _mm256_set1_ps(size[0]);
+    const __m256 sy = _mm256_set1_ps(size[1]);
+    const __m256 sz = _mm256_set1_ps(size[2]);
+
+    // no FMA to round like the scalar kernel
+    size_t i = 0;
+    for (; i + 8 <= numEvents; i += 8)
+    {
+        const __m256 x = _mm256_floor_ps(_mm256_add_ps(
+            _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(posx + i), ox), ix),
+            half));
+        const __m256 y = _mm256_floor_ps(_mm256_add_ps(
+            _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(posy + i), oy), iy),
+            half));
+        const __m256 z = _mm256_floor_ps(_mm256_add_ps(
+            _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(posz + i), oz), iz),
+            half));
+        const __m256 valid = _mm256_and_ps(
+            _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(x, zero, _CMP_GE_OQ),
+                                        _mm256_cmp_ps(x, sx, _CMP_LT_OQ)),
+                          _mm256_and_ps(_mm256_cmp_ps(y, zero, _CMP_GE_OQ),
+                                        _mm256_cmp_ps(y, sy, _CMP_LT_OQ))),
+            _mm256_and_ps(_mm256_cmp_ps(z, zero, _CMP_GE_OQ),
+                          _mm256_cmp_ps(z, sz, _CMP_LT_OQ)));
+
+        alignas(32) int32_t cx[8], cy[8], cz[8];
+        _mm256_store_si256((__m256i*)cx, _mm256_cvttps_epi32(x));
+        _mm256_store_si256((__m256i*)cy, _mm256_cvttps_epi32(y));
+        _mm256_store_si256((__m256i*)cz, _mm256_cvttps_epi32(z));
+        const int mask = _mm256_movemask_ps(valid);
+        for (size_t j = 0; j < 8; ++j)
+            indices[i + j] = (mask & (1 << j))
+                                 ? _getLinearIndex(cx[j], cy[j], cz[j], size)
+                                 : -1;
+    }
+    _computeVoxelIndicesScalar(posx + i, posy + i, posz + i, numEvents - i,
+                               origin, invSpacing, size, indices + i);
+}
+
+/* AVX-512 */
+#if defined(__GNUC__) && !defined(__clang__)
+// false positives for the undefined sources of the AVX-512 intrinsics
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+FIVOX_TARGET("avx512f")
+inline __m512 _fieldAVX512(const __m512 distance2, const __m512 radius,
+                           const __m512 value, const __m512 squaredCutoff)
+{
+    const __m512 d = _mm512_max_ps(distance2, _mm512_set1_ps(FLT_MIN));
+    __m512 r = _mm512_rcp14_ps(d);
+    r = _mm512_mul_ps(r, _mm512_fnmadd_ps(d, r, _mm512_set1_ps(2.f)));
+
+    const __mmask16 near =
+        _mm512_cmp_ps_mask(r, _mm512_mul_ps(radius, radius), _CMP_GT_OQ);
+    const __mmask16 inside = _mm512_cmp_ps_mask(r, squaredCutoff, _CMP_GE_OQ);
+    return _mm512_maskz_mul_ps(inside, value,
+                               _mm512_mask_blend_ps(near, r, radius));
+}
+
+/** @return the mask of the first n lanes, n <= 16 */
+inline __mmask16 _getMaskAVX512(const size_t n)
+{
+    return __mmask16((1u << n) - 1);
+}
+
+FIVOX_TARGET("avx512f")
+float _sampleFieldAVX512(const float* posx, const float* posy,
+                         const float* posz, const float* radii,
+                         const float* values, const size_t begin,
+                         const size_t end, const Vector3f& point,
+                         const float cutOffDistance)
+{
+    const __m512 px = _mm512_set1_ps(point[0]);
+    const __m512 py = _mm512_set1_ps(point[1]);
+    const __m512 pz = _mm512_set1_ps(point[2]);
+    const __m512 squaredCutoff =
+        _mm512_set1_ps(1.f / (cutOffDistance * cutOffDistance));
+
+    __m512 voltage = _mm512_setzero_ps();
+    for (size_t i = begin; i < end; i += 16)
+    {
+        const __mmask16 mask = _getMaskAVX512(std::min<size_t>(end - i, 16));
+        const __m512 dx =
+            _mm512_sub_ps(px, _mm512_maskz_loadu_ps(mask, posx + i));
+        const __m512 dy =
+            _mm512_sub_ps(py, _mm512_maskz_loadu_ps(mask, posy + i));
+        const __m512 dz =
+            _mm512_sub_ps(pz, _mm512_maskz_loadu_ps(mask, posz + i));
+        const __m512 distance2 = _mm512_fmadd_ps(
+            dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dz, dz)));
+        voltage = _mm512_mask_add_ps(
+            voltage, mask, voltage,
+            _fieldAVX512(distance2, _mm512_maskz_loadu_ps(mask, radii + i),
+                         _mm512_maskz_loadu_ps(mask, values + i),
+                         squaredCutoff));
+    }
+
+    const __m256 half = _mm256_add_ps(
+        _mm512_castps512_ps256(voltage),
+        _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(voltage), 1)));
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(half),
+                            _mm256_extractf128_ps(half, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+}
+
+FIVOX_TARGET("avx512f")
+void _addFieldRowAVX512(const float offsetX, const float distanceYZ2,
+                        const float radius, const float value,
+                        const float step, const float squaredCutoff,
+                        const size_t begin, const size_t end, float* output)
+{
+    const __m512 offset = _mm512_set1_ps(offsetX);
+    const __m512 yz2 = _mm512_set1_ps(distanceYZ2);
+    const __m512 radii = _mm512_set1_ps(radius);
+    const __m512 values = _mm512_set1_ps(value);
+    const __m512 steps = _mm512_set1_ps(step);
+    const __m512 cutoff = _mm512_set1_ps(squaredCutoff);
+    const __m512 lanes =
+        _mm512_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f, 8.f, 9.f, 10.f,
+                       11.f, 12.f, 13.f, 14.f, 15.f);
+
+    for (size_t j = begin; j < end; j += 16)
+    {
+        const __mmask16 mask = _getMaskAVX512(std::min<size_t>(end - j, 16));
+        const __m512 index = _mm512_add_ps(_mm512_set1_ps(float(j)), lanes);
+        const __m512 dx = _mm512_fmadd_ps(index, steps, offset);
+        const __m512 distance2 = _mm512_fmadd_ps(dx, dx, yz2);
+        _mm512_mask_storeu_ps(
+            output + j, mask,
+            _mm512_add_ps(_mm512_maskz_loadu_ps(mask, output + j),
+                          _fieldAVX512(distance2, radii, values, cutoff)));
+    }
+}
+
+FIVOX_TARGET("avx512f")
+void _sampleFieldLineAVX512(const float* posx, const float* posy,
+                            const float* posz, const float* radii,
+                            const float* values, const size_t begin,
+                            const size_t end, const Vector3f& point,
+                            const float step, const size_t size,
+                            const float cutOffDistance, float* output)
+{
+    _sampleFieldLine<_addFieldRowAVX512>(posx, posy, posz, radii, values,
+                                         begin, end, point, step, size,
+                                         cutOffDistance, output);
+}
+
+FIVOX_TARGET("avx512f")
+void _splatFieldAVX512(const float* posx, const float* posy,
+                       const float* posz, const float* radii,
+                       const float* values, const size_t begin,
+                       const size_t end, const Vector3f& origin,
+                       const Vector3f& spacing, const Vector3ui& size,
+                       const float cutOffDistance, float* output)
+{
+    _splatField<_addFieldRowAVX512>(posx, posy, posz, radii, values, begin,
+                                    end, origin, spacing, size,
+                                    cutOffDistance, output);
+}
+
+FIVOX_TARGET("avx512f")
+void _computeVoxelIndicesAVX512(const float* posx, const float* posy,
+                                const float* posz, const size_t numEvents,
+                                const Vector3f& origin,
+                                const Vector3f& invSpacing,
+                                const Vector3ui& size, int64_t* indices)
+{
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 o[3] = {_mm512_set1_ps(origin[0]), _mm512_set1_ps(origin[1]),
+                         _mm512_set1_ps(origin[2])};
+    const __m512 inv[3] = {_mm512_set1_ps(invSpacing[0]),
+                           _mm512_set1_ps(invSpacing[1]),
+                           _mm512_set1_ps(invSpacing[2])};
+    const __m512 s[3] = {_mm512_set1_ps(size[0]), _mm512_set1_ps(size[1]),
+                         _mm512_set1_ps(size[2])};
+    const float* positions[3] = {posx, posy, posz};
+
+    // no FMA to round like the scalar kernel
+    size_t i = 0;
+    for (; i + 16 <= numEvents; i += 16)
+    {
+        alignas(64) int32_t coordinates[3][16];
+        __mmask16 valid = 0xffff;
+        for (size_t k = 0; k < 3; ++k)
+        {
+            const __m512 c = _mm512_floor_ps(_mm512_add_ps(
+                _mm512_mul_ps(
+                    _mm512_sub_ps(_mm512_loadu_ps(positions[k] + i), o[k]),
+                    inv[k]),
+                half));
+            valid &= _mm512_cmp_ps_mask(c, zero, _CMP_GE_OQ) &
+                     _mm512_cmp_ps_mask(c, s[k], _CMP_LT_OQ);
+            _mm512_store_si512(coordinates[k], _mm512_cvttps_epi32(c));
+        }
+        for (size_t j = 0; j < 16; ++j)
+            indices[i + j] =
+                (valid & (1 << j))
+                    ? _getLinearIndex(coordinates[0][j], coordinates[1][j],
+                                      coordinates[2][j], size)
+                    : -1;
+    }
+    _computeVoxelIndicesScalar(posx + i, posy + i, posz + i, numEvents - i,
+                               origin, invSpacing, size, indices + i);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+struct Kernels
+{
+    decltype(&_sampleFieldScalar) sampleField;
+    decltype(&_sampleFieldLineScalar) sampleFieldLine;
+    decltype(&_splatFieldScalar) splatField;
+    decltype(&_computeVoxelIndicesScalar) computeVoxelIndices;
+};
+
+Kernels _getKernels(const KernelType type)
+{
+    switch (type)
+    {
+#ifdef FIVOX_USE_SIMD
+    case KernelType::sse4:
+        return {_sampleFieldSSE4, _sampleFieldLineSSE4, _splatFieldSSE4,
+                _computeVoxelIndicesSSE4};
+    case KernelType::avx2:
+        return {_sampleFieldAVX2, _sampleFieldLineAVX2, _splatFieldAVX2,
+                _computeVoxelIndicesAVX2};
+    case KernelType::avx512:
+        return {_sampleFieldAVX512, _sampleFieldLineAVX512, _splatFieldAVX512,
+                _computeVoxelIndicesAVX512};
+#endif
+    default:
+        return {_sampleFieldScalar, _sampleFieldLineScalar, _splatFieldScalar,
+                _computeVoxelIndicesScalar};
+    }
+}
+
+KernelType _getBestType()
+{
+#ifdef FIVOX_USE_SIMD
+    // needed as this runs during static initialization
+    __builtin_cpu_init();
+#endif
+    for (const KernelType type :
+         {KernelType::avx512, KernelType::avx2, KernelType::sse4})
+    {
+        if (isSupported(type))
+            return type;
+    }
+    return KernelType::scalar;
+}
+
+KernelType _type = _getBestType();
+Kernels _kernels = _getKernels(_type);
+}
+
+bool isSupported(const KernelType type)
+{
+    switch (type)
+    {
+    case KernelType::scalar:
+        return true;
+#ifdef FIVOX_USE_SIMD
+    case KernelType::sse4:
+        return __builtin_cpu_supports("sse4.1");
+    case KernelType::avx2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    case KernelType::avx512:
+        return __builtin_cpu_supports("avx512f");
+#endif
+    default:
+        return false;
+    }
+}
+
+KernelType getKernelType()
+{
+    return _type;
+}
+
+void setKernelType(const KernelType type)
+{
+    if (!isSupported(type))
+        LBTHROW(std::runtime_error("Unsupported kernel type " +
+                                   std::to_string(int(type))));
+    _type = type;
+    _kernels = _getKernels(type);
+}
+
+float sampleField(const float* posx, const float* posy, const float* posz,
+                  const float* radii, const float* values, const size_t begin,
+                  const size_t end, const Vector3f& point,
+                  const float cutOffDistance)
+{
+    return _kernels.sampleField(posx, posy, posz, radii, values, begin, end,
+                                point, cutOffDistance);
+}
+
+void sampleFieldLine(const float* posx, const float* posy, const float* posz,
+                     const float* radii, const float* values,
+                     const size_t begin, const size_t end,
+                     const Vector3f& point, const float step, const size_t size,
+                     const float cutOffDistance, float* output)
+{
+    _kernels.sampleFieldLine(posx, posy, posz, radii, values, begin, end, point,
+                             step, size, cutOffDistance, output);
+}
+
+void splatField(const float* posx, const float* posy, const float* posz,
+                const float* radii, const float* values, const size_t begin,
+                const size_t end, const Vector3f& origin,
+                const Vector3f& spacing, const Vector3ui& size,
+                const float cutOffDistance, float* output)
+{
+    _kernels.splatField(posx, posy, posz, radii, values, begin, end, origin,
+                        spacing, size, cutOffDistance, output);
+}
+
+void computeVoxelIndices(const float* posx, const float* posy,
+                         const float* posz, const size_t numEvents,
+                         const Vector3f& origin, const Vector3f& invSpacing,
+                         const Vector3ui& size, int64_t* indices)
+{
+    _kernels.computeVoxelIndices(posx, posy, posz, numEvents, origin,
+                                 invSpacing, size, indices);
+}
+}
+}
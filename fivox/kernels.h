@@ -0,0 +1,132 @@
+/* Copyright (c) 2017, EPFL/Blue Brain Project
+ *
+ * This file is part of Fivox <https://github.com/BlueBrain/Fivox>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef FIVOX_KERNELS_H
+#define FIVOX_KERNELS_H
+
+#include <fivox/api.h>
+#include <fivox/types.h>
+
+namespace fivox
+{
+/**
+ * Inner loops of the image sources and functors.
+ *
+ * Each kernel has a scalar implementation and SIMD implementations for the
+ * instruction sets of KernelType. The best type supported by the CPU is
+ * selected when the library is loaded.
+ */
+namespace kernels
+{
+/** @return true if the CPU and the compiler support the given type. */
+FIVOX_API bool isSupported(KernelType type);
+
+/** @return the type of the kernels in use. */
+FIVOX_API KernelType getKernelType();
+
+/**
+ * Select the type of the kernels, e.g. for testing. Must not be called while
+ * other threads use the kernels.
+ *
+ * @throw std::runtime_error if the type is not supported.
+ */
+FIVOX_API void setKernelType(KernelType type);
+
+/**
+ * Sum the field of the events [begin, end) at the given point.
+ *
+ * The field of an event decays with the squared distance up to the cutoff
+ * distance, and is clamped to value * radius within the event radius. The
+ * radii are inverted, as stored by EventSource.
+ */
+FIVOX_API float sampleField(const float* posx, const float* posy,
+                            const float* posz, const float* radii,
+                            const float* values, size_t begin, size_t end,
+                            const Vector3f& point, float cutOffDistance);
+
+/**
+ * Accumulate the field of the events [begin, end) on a line of voxels along
+ * X, starting at the given point.
+ *
+ * @param step the distance between voxels.
+ * @param size the number of voxels.
+ * @param output the voxel values to add to.
+ */
+FIVOX_API void sampleFieldLine(const float* posx, const float* posy,
+                               const float* posz, const float* radii,
+                               const float* values, size_t begin, size_t end,
+                               const Vector3f& point, float step, size_t size,
+                               float cutOffDistance, float* output);
+
+/**
+ * Accumulate the field of the events [begin, end) on a block of voxels.
+ *
+ * @param origin the position of the first voxel.
+ * @param spacing the distance between voxels along each dimension.
+ * @param size the number of voxels along each dimension.
+ * @param output the voxel values to add to, with X fastest.
+ */
+FIVOX_API void splatField(const float* posx, const float* posy,
+                          const float* posz, const float* radii,
+                          const float* values, size_t begin, size_t end,
+                          const Vector3f& origin, const Vector3f& spacing,
+                          const Vector3ui& size, float cutOffDistance,
+                          float* output);
+
+/**
+ * Compute the linear index of the voxel containing each event, or -1 for
+ * events outside of the volume.
+ *
+ * Voxels are centered on their positions like in itk::Image, and enumerated
+ * with X fastest.
+ *
+ * @param origin the center of the first voxel.
+ * @param invSpacing the inverse of the voxel size.
+ * @param size the number of voxels along each dimension.
+ */
+FIVOX_API void computeVoxelIndices(const float* posx, const float* posy,
+                                   const float* posz, size_t numEvents,
+                                   const Vector3f& origin,
+                                   const Vector3f& invSpacing,
+                                   const Vector3ui& size, int64_t* indices);
+
+/** The initial hash of hashValue() and hashWords(). */
+const uint64_t hashSeed = 14695981039346656037ull;
+
+/**
+ * @return the given hash continued with one value by 64 bit FNV-1a, e.g. to
+ *         identify the events of cache files.
+ */
+inline uint64_t hashValue(const uint64_t value, const uint64_t hash = hashSeed)
+{
+    return (hash ^ value) * 1099511628211ull;
+}
+
+/** @return the given hash continued with each of the given 32 bit words. */
+inline uint64_t hashWords(const void* data, const size_t numWords,
+                          uint64_t hash = hashSeed)
+{
+    const uint32_t* words = static_cast<const uint32_t*>(data);
+    for (size_t i = 0; i < numWords; ++i)
+        hash = hashValue(words[i], hash);
+    return hash;
+}
+}
+}
+
+#endif
@@ -43,38 +43,33 @@ public:
         : _output(output)
         , _report(params.getConfig().getReportSource(params.getReport()),
                   brion::MODE_READ, params.getGIDs())
+        , _frames(_report, params.getReadAhead())
     {
-        const brain::Circuit circuit(params.getConfig());
-        const auto morphologies =
-            circuit.loadMorphologies(params.getGIDs(),
-                                     brain::Circuit::Coordinates::global);
-
         // add soma events only
-        helpers::addCompartmentEvents(morphologies, _report, output, true);
+        helpers::addCompartmentEvents(params, _report, output, true);
     }
 
     ssize_t load()
     {
-        const brion::floatsPtr frame =
-            _report.loadFrame(_output.getCurrentTime()).get();
+        const brion::floatsPtr frame = _frames.load(_output);
         if (!frame)
             return -1;
 
         const brion::GIDSet& gids = _report.getGIDs();
         const brion::SectionOffsets& offsets = _report.getOffsets();
-        const std::vector<float> reportValues = *frame;
-
+        const brion::floats& reportValues = *frame;
+        const uint32_t* order = _output.getGeometry()->getOrder();
         for (size_t i = 0; i < gids.size(); ++i)
         {
             // This code assumes that section 0 is the soma.
-            const float v = reportValues[offsets[i][0]];
-            _output[i] = v;
+            _output[i] = reportValues[offsets[order ? order[i] : i][0]];
         }
         return gids.size();
     }
 
     EventSource& _output;
     brion::CompartmentReport _report;
+    helpers::FramePrefetcher _frames;
 };
 
 SomaLoader::SomaLoader(const URIHandler& params)
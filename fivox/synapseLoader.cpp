@@ -69,12 +69,13 @@ public:
         if (_synapses.eos())
             _synapses = _loadSynapseStream();
         _output.resize(synapses.size());
-        const float* __restrict__ posx = synapses.preSurfaceXPositions();
-        const float* __restrict__ posy = synapses.preSurfaceYPositions();
-        const float* __restrict__ posz = synapses.preSurfaceZPositions();
-        for (size_t i = 0; i < synapses.size(); ++i)
-            _output.update(i, Vector3f(posx[i], posy[i], posz[i]),
-                           /*radius*/ 0.f, /*value*/ 1.f);
+
+        // radius 0 from resize(), value 1
+        const std::vector<float> values(synapses.size(), 1.f);
+        _output.update(0, synapses.size(), synapses.preSurfaceXPositions(),
+                       synapses.preSurfaceYPositions(),
+                       synapses.preSurfaceZPositions(), nullptr,
+                       values.data());
 
         return synapses.size();
     }
@@ -22,6 +22,7 @@
 #define FIVOX_TYPES_H
 
 #include <brion/types.h>
+#include <functional>
 #include <memory>
 #include <vector>
 #include <vmmlib/aabb.hpp>
@@ -46,6 +47,8 @@ class SmartPointer;
  */
 namespace fivox
 {
+class EventGeometry;
+class EventGrid;
 class EventSource;
 class URIHandler;
 template <class TImage>
@@ -55,6 +58,8 @@ class ImageSource;
 
 typedef std::shared_ptr<EventSource> EventSourcePtr;
 typedef std::shared_ptr<const EventSource> ConstEventSourcePtr;
+typedef std::shared_ptr<EventGeometry> EventGeometryPtr;
+typedef std::shared_ptr<const EventGeometry> ConstEventGeometryPtr;
 
 typedef itk::Image<uint8_t, 3> ByteVolume;
 typedef itk::Image<float, 3> FloatVolume;
@@ -65,6 +70,7 @@ struct EventsDeleter
 };
 typedef std::unique_ptr<float, EventsDeleter> Events;
 typedef brion::floats EventValues;
+typedef std::function<void(size_t index)> EventVisitor;
 
 using vmml::Vector2f;
 using vmml::Vector3f;
@@ -98,10 +104,11 @@ enum class VolumeType
 enum class FunctorType
 {
     unknown,
-    density,  //!< sum( magnitude of events in voxel ) / volume of voxel
-    lfp,      //!< LFP computation
-    field,    //!< quadratic falloff of magnitude in space
-    frequency //!< maximum magnitude of all events in voxel
+    density,         //!< sum( magnitude of events in voxel ) / volume of voxel
+    lfp,             //!< LFP computation
+    field,           //!< quadratic falloff of magnitude in space
+    frequency,       //!< maximum magnitude of all events in voxel
+    approximateField //!< field with distant events grouped (Barnes-Hut)
 };
 
 /** @internal Different types of event sources which defines
@@ -112,11 +119,34 @@ enum class SourceType
     frame  //!< e.g. compartment reports
 };
 
+/** Strategies of the image sources to compute the voxel values */
+enum class SamplingMode
+{
+    gather,      //!< sample each voxel from the events around it
+    splat,       //!< add each event to the voxels within its cutoff distance
+    convolution, //!< convolve the events with the field, see
+                 //!< ConvolutionImageSource
+    matrix,      //!< multiply the values with a precomputed matrix, see
+                 //!< InfluenceMatrixImageSource
+    binning      //!< reduce the events into the voxel they fall into, see
+                 //!< BinningImageSource
+};
+
 /** Supported formats to read or write event files */
 enum class EventFileFormat
 {
     ascii,
-    binary
+    binary, //!< version 1, one event after the other
+    mapped  //!< version 2, one aligned column per attribute, read in place
+};
+
+/** Instruction sets of the sampling kernels, see kernels.h */
+enum class KernelType
+{
+    scalar, //!< portable C++ fallback
+    sse4,   //!< 4-wide SSE4.1
+    avx2,   //!< 8-wide AVX2 with FMA
+    avx512  //!< 16-wide AVX-512F
 };
 
 /** Indicates to consider all data for potential rescaling. */
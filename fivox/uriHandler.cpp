@@ -21,7 +21,10 @@
 
 #include "uriHandler.h"
 
+#include <fivox/approximateFieldFunctor.h>
+#include <fivox/binningImageSource.h>
 #include <fivox/compartmentLoader.h>
+#include <fivox/convolutionImageSource.h>
 #include <fivox/densityFunctor.h>
 #include <fivox/fieldFunctor.h>
 #include <fivox/frequencyFunctor.h>
@@ -33,6 +36,7 @@
 #endif
 #include <fivox/eventValueSummationImageSource.h>
 #include <fivox/functorImageSource.h>
+#include <fivox/influenceMatrixImageSource.h>
 #include <fivox/genericLoader.h>
 #include <fivox/somaLoader.h>
 #include <fivox/spikeLoader.h>
@@ -59,7 +63,10 @@ const double _dt = -1.0; // loaders use experiment/report dt
 const size_t _maxBlockSize = LB_64MB;
 const float _cutoff = 100.0f; // micrometers
 const float _extend = 0.f;    // micrometers
+const float _theta = 0.5f;    // Barnes-Hut opening angle
+const float _delta = -1.f;    // no incremental updates
 const float _gidFraction = 1.f;
+const size_t _readAhead = 4; // frames of a declared frame window
 }
 
 class URIHandler::Impl
@@ -227,16 +234,53 @@ public:
         return _get("maxBlockSize", _maxBlockSize);
     }
 
+    size_t getMaxEventMemory() const
+    {
+        return _get("maxEventMemory", size_t(0));
+    }
+
     float getCutoffDistance() const
     {
         return std::max(_get("cutoff", _cutoff), 0.f);
     }
 
+    SamplingMode getSamplingMode() const
+    {
+        const std::string& sampling = _get("sampling");
+        if (sampling == "splat")
+            return SamplingMode::splat;
+        if (sampling == "convolution")
+            return SamplingMode::convolution;
+        if (sampling == "matrix")
+            return SamplingMode::matrix;
+        if (sampling == "binning")
+            return SamplingMode::binning;
+        return SamplingMode::gather;
+    }
+
+    float getOpeningAngle() const
+    {
+        return std::max(_get("theta", _theta), 0.f);
+    }
+
+    std::string getMatrixFilename() const { return _get("matrix"); }
+
+    float getDeltaTolerance() const { return _get("delta", _delta); }
+
+    std::string getValueCacheFilename() const { return _get("valueCache"); }
+    std::string getGeometryCache() const { return _get("geometryCache"); }
+    size_t getValueCacheBits() const
+    {
+        return _get("valueCacheBits", 32) == 16 ? 16 : 32;
+    }
+
     float getExtendDistance() const
     {
         return std::max(_get("extend", _extend), 0.f);
     }
 
+    bool getSortEvents() const { return _get("sortEvents", false); }
+    size_t getReadAhead() const { return _get("readAhead", _readAhead); }
     float getGIDFraction() const { return _get("gidFraction", _gidFraction); }
     std::string getReferenceVolume() const { return _get("reference"); }
     size_t getSizeInVoxel() const { return _get("size", 0); }
@@ -319,6 +363,8 @@ public:
             return FunctorType::frequency;
         if (functor == "lfp")
             return FunctorType::lfp;
+        if (functor == "approximateField")
+            return FunctorType::approximateField;
 
         switch (getType())
         {
@@ -356,6 +402,9 @@ private:
         }
     }
 
+    // param present with no value = true
+    bool _get(const std::string& param, bool defaultValue) const;
+
     const URI uri;
     bool useTestData;
     std::unique_ptr<brion::BlueConfig> config;
@@ -363,8 +412,6 @@ private:
     brion::GIDSet preGIDs;
 };
 
-// bool specialization: param present with no value = true
-template <>
 bool URIHandler::Impl::_get(const std::string& param,
                             const bool defaultValue) const
 {
@@ -455,11 +502,61 @@ size_t URIHandler::getMaxBlockSize() const
     return _impl->getMaxBlockSize();
 }
 
+size_t URIHandler::getMaxEventMemory() const
+{
+    return _impl->getMaxEventMemory();
+}
+
 float URIHandler::getCutoffDistance() const
 {
     return _impl->getCutoffDistance();
 }
 
+float URIHandler::getOpeningAngle() const
+{
+    return _impl->getOpeningAngle();
+}
+
+float URIHandler::getDeltaTolerance() const
+{
+    return _impl->getDeltaTolerance();
+}
+
+std::string URIHandler::getMatrixFilename() const
+{
+    return _impl->getMatrixFilename();
+}
+
+SamplingMode URIHandler::getSamplingMode() const
+{
+    return _impl->getSamplingMode();
+}
+
+std::string URIHandler::getValueCacheFilename() const
+{
+    return _impl->getValueCacheFilename();
+}
+
+size_t URIHandler::getValueCacheBits() const
+{
+    return _impl->getValueCacheBits();
+}
+
+std::string URIHandler::getGeometryCache() const
+{
+    return _impl->getGeometryCache();
+}
+
+bool URIHandler::getSortEvents() const
+{
+    return _impl->getSortEvents();
+}
+
+size_t URIHandler::getReadAhead() const
+{
+    return _impl->getReadAhead();
+}
+
 float URIHandler::getExtendDistance() const
 {
     return _impl->getExtendDistance();
@@ -515,9 +612,18 @@ Parameters for all types :
              [-15.0, 0.0] for Somas with TestData, [-80.0, 0.0] otherwise
              [-0.0000147, 0.00225] for LFP with TestData, [-10.0, 10.0] otherwise
              [-100000.0, 300.0] for VSD)
-- functor: type of functor to sample the data into the voxels (defaults: 'density' for Synapses, 'frequency' for Spikes, 'field' for Compartments, Somas and VSD)
+- functor: type of functor to sample the data into the voxels (defaults: 'density' for Synapses, 'frequency' for Spikes, 'field' for Compartments, Somas and VSD). 'approximateField' approximates 'field' for large cutoff distances
+- theta: opening angle of the 'approximateField' functor, smaller values are more accurate and slower, 0 is exact (default: 0.5)
 - maxBlockSize: maximum memory usage allowed for one block in bytes (default: 64MB)
+- maxEventMemory: memory budget in bytes for the events of the 'generic' source, which voxelizes its event file in chunks within the budget and adds up their volumes for the 'field', 'approximateField' and 'density' functors; only binary version 2 event files are mapped instead of read into memory as a whole (default: 0, all events at once)
 - cutoff: the cutoff distance in micrometers (default: 100)
+- sampling: 'gather' to sample each voxel from the events around it, 'splat' to add each event to the voxels within the cutoff distance, faster for sparse events at high resolutions, 'convolution' to convolve the events with the 'field' functor by FFT, faster for cutoff distances of many voxels but approximate further than one voxel from the events, 'matrix' to precompute the weights of the events on the voxels for the 'field' functor once, faster for many frames of events which do not move, or 'binning' to add each event to the voxel it falls into for the 'density' and 'frequency' functors, faster for many events (default: gather)
+- readAhead: maximum number of frames read ahead of the current one by the compartment, soma and VSD loaders, within the frames declared by the application, e.g. those of --frames (default: 4)
+- delta: minimum change of an event value to update the volume of the previous frame with it instead of recomputing it, for the 'field' functor; negative to disable (default: -1)
+- matrix: file prefix to store the weights of 'sampling=matrix' in, reused by later runs for the same events and volume (default: in memory)
+- valueCache: file to store the event values of each loaded frame in, reused by later runs for the same events, time step, data source and loader options, e.g. of VSD, instead of loading the frames again; a file written for other ones is overwritten (default: unset)
+- valueCacheBits: 16 to quantize the values in the 'valueCache' file to 16 bit per frame, 32 to store them exactly (default: 32)
+- geometryCache: directory to store the events created from the circuit and report of the compartment, soma and VSD sources in, one file per circuit, report, cells and event options, reused by later runs instead of loading the morphologies again; remove the files when the circuit changes (default: unset)
 - extend: the additional distance, in micrometers, by which the original data volume will be extended in every dimension (default: 0, the volume extent matches the bounding box of the data events). Changing this parameter will result in more volumetric data, and therefore more computation time
 - reference: path to a reference volume to take its size and resolution, overwrites the 'size' and 'resolution' parameter
 - size: size in voxels along the largest dimension of the volume, overwrites the 'resolution' parameter
@@ -526,6 +632,7 @@ Parameters for all types :
 Parameters for Compartments:
 - report: name of the compartment report (default: 'voltage'; 'allvoltage' if BlueConfig is BBPTestData)
 - dt: timestep between requested frames in milliseconds (default: report dt)
+- sortEvents: sort the compartments along a space-filling curve once they are created, which speeds up the voxelization of large circuits (default: report order)
 
 Parameters for Somas:
 - report: name of the soma report (default: 'soma'; 'voltage' if BlueConfig is BBPTestData)
@@ -538,7 +645,8 @@ Parameters for Spikes:
 Parameters for VSD:
 - report: name of the voltage report (default: 'soma'; 'voltage' if BlueConfig is BBPTestData)
 - areas: path to an area report file (default: path to TestData areas if BlueConfig is BBPTestData)
-- dt: timestep between requested frames in milliseconds (default: report dt))";
+- dt: timestep between requested frames in milliseconds (default: report dt)
+- sortEvents: see Compartments)";
     //! [VolumeParameters]
 }
 
@@ -554,6 +662,29 @@ ImageSourcePtr<TImage> URIHandler::newImageSource() const
         source = EventValueSummationImageSource<TImage>::New();
         break;
     default:
+        if (getFunctorType() == FunctorType::field &&
+            getSamplingMode() == SamplingMode::convolution)
+        {
+            source = ConvolutionImageSource<TImage>::New();
+            break;
+        }
+        if (getFunctorType() == FunctorType::field &&
+            getSamplingMode() == SamplingMode::matrix)
+        {
+            auto matrixSource = InfluenceMatrixImageSource<TImage>::New();
+            matrixSource->setFilename(getMatrixFilename());
+            source = matrixSource;
+            break;
+        }
+        if ((getFunctorType() == FunctorType::density ||
+             getFunctorType() == FunctorType::frequency) &&
+            getSamplingMode() == SamplingMode::binning)
+        {
+            auto binningSource = BinningImageSource<TImage>::New();
+            binningSource->setFunctorType(getFunctorType());
+            source = binningSource;
+            break;
+        }
 #ifdef FIVOX_USE_CUDA
         bool cudaCapable = false;
         if (getFunctorType() == FunctorType::lfp)
@@ -576,6 +707,9 @@ ImageSourcePtr<TImage> URIHandler::newImageSource() const
             auto functorSource = FunctorImageSource<TImage>::New();
             auto functor = newFunctor<TImage>();
             functorSource->setFunctor(functor);
+            functorSource->setSamplingMode(getSamplingMode());
+            functorSource->setDeltaTolerance(getDeltaTolerance());
+            functorSource->setChunkedLoading(getMaxEventMemory() > 0);
             functor->setEventSource(eventSource);
             source = functorSource;
         }
@@ -621,6 +755,9 @@ EventFunctorPtr<TImage> URIHandler::newFunctor() const
         return std::make_shared<FieldFunctor<TImage>>();
     case FunctorType::frequency:
         return std::make_shared<FrequencyFunctor<TImage>>();
+    case FunctorType::approximateField:
+        return std::make_shared<ApproximateFieldFunctor<TImage>>(
+            getOpeningAngle());
 #ifdef FIVOX_USE_LFP
     case FunctorType::lfp:
         return std::make_shared<LFPFunctor<TImage>>();
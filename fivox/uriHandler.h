@@ -142,6 +142,14 @@ public:
      */
     FIVOX_API size_t getMaxBlockSize() const;
 
+    /**
+     * Get the memory budget in bytes for the events of one chunk of an event
+     * file, from the 'maxEventMemory' parameter.
+     *
+     * @return the budget, or 0 to load all events at once.
+     */
+    FIVOX_API size_t getMaxEventMemory() const;
+
     /**
      * Get the specified cutoff distance in micrometers.
      *
@@ -150,6 +158,81 @@ public:
      */
     FIVOX_API float getCutoffDistance() const;
 
+    /**
+     * Get the opening angle of the approximate field functor, from the
+     * 'theta' parameter.
+     *
+     * @return the opening angle. If invalid or empty, return 0.5.
+     */
+    FIVOX_API float getOpeningAngle() const;
+
+    /**
+     * Get how the image source computes the voxel values.
+     *
+     * @return SamplingMode::splat, SamplingMode::convolution,
+     *         SamplingMode::matrix or SamplingMode::binning if the 'sampling'
+     *         parameter is "splat", "convolution", "matrix" or "binning",
+     *         SamplingMode::gather otherwise.
+     */
+    FIVOX_API SamplingMode getSamplingMode() const;
+
+    /**
+     * Get the prefix of the files storing the influence matrices of
+     * SamplingMode::matrix, from the 'matrix' parameter.
+     *
+     * @return the file prefix. If empty, the matrices are kept in memory.
+     */
+    FIVOX_API std::string getMatrixFilename() const;
+
+    /**
+     * Get the minimum change of an event value to update the volume of the
+     * previous frame incrementally, from the 'delta' parameter.
+     *
+     * @return the tolerance. If invalid or empty, return -1 to disable
+     *         incremental updates.
+     */
+    FIVOX_API float getDeltaTolerance() const;
+
+    /**
+     * Get the file storing the event values of each loaded frame for later
+     * runs, from the 'valueCache' parameter.
+     *
+     * @return the file name. If empty, the frames are always loaded.
+     */
+    FIVOX_API std::string getValueCacheFilename() const;
+
+    /**
+     * Get the number of bits per value in the value cache file, from the
+     * 'valueCacheBits' parameter.
+     *
+     * @return 16 to quantize the values of each frame, 32 otherwise.
+     */
+    FIVOX_API size_t getValueCacheBits() const;
+
+    /**
+     * Get the directory storing the events created from compartment reports
+     * for later runs, from the 'geometryCache' parameter.
+     *
+     * @return the directory. If empty, the events are always created.
+     */
+    FIVOX_API std::string getGeometryCache() const;
+
+    /**
+     * Get whether the events created from a compartment report are sorted
+     * spatially, from the 'sortEvents' parameter.
+     *
+     * @return true to sort the events, see EventGeometry::sortSpatially().
+     */
+    FIVOX_API bool getSortEvents() const;
+
+    /**
+     * Get the maximum number of frames read ahead by report loaders, from the
+     * 'readAhead' parameter.
+     *
+     * @return the number of frames, see EventSource::setFrameWindow().
+     */
+    FIVOX_API size_t getReadAhead() const;
+
     /**
      * Get the additional distance, in micrometers, by which the original data
      * volume will be extended. By default, the volume extension matches the
@@ -168,7 +251,8 @@ public:
     FIVOX_API VolumeType getType() const;
 
     /**
-     * Available functors are "density", "field", "frequency" and "lfp".
+     * Available functors are "density", "field", "frequency", "lfp" and
+     * "approximateField".
      * If "functor" is unspecified, the default functor for the VolumeType is
      * returned:
      * - FunctorType::field for VolumeType::compartments and VolumeType::somas
@@ -0,0 +1,353 @@
+/* Copyright (c) 2017, EPFL/Blue Brain Project
+ *
+ * This file is part of Fivox <https://github.com/BlueBrain/Fivox>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "valueCache.h"
+#include "eventGeometry.h"
+#include "eventSource.h"
+#include "kernels.h"
+
+#include <lunchbox/log.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fivox
+{
+namespace
+{
+const uint32_t _magic = 0xf1cac4e1;
+const uint32_t _version = 1;
+const size_t _frameAlignment = 64;
+const size_t _dataAlignment = 4096;
+const float _maxQuantized = std::numeric_limits<uint16_t>::max();
+
+/** Layout of a cache file, followed by the frame table and the frames */
+struct Header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t hash;
+    uint64_t numEvents;
+    uint32_t frameRange[2];
+    uint32_t quantized;
+    uint32_t padding;
+    uint64_t frameSize; // in bytes, including the padding
+    uint64_t dataOffset;
+};
+
+/** Entry of the frame table, written after the values of the frame */
+struct Frame
+{
+    uint32_t written;
+    float offset; // of the quantized values
+    float scale;
+    uint32_t padding;
+};
+
+size_t _align(const size_t size, const size_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+bool _write(const int fd, const void* data, size_t size, off_t offset)
+{
+    const char* ptr = static_cast<const char*>(data);
+    while (size > 0)
+    {
+        const ssize_t written = ::pwrite(fd, ptr, size, offset);
+        if (written <= 0)
+            return false;
+        ptr += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+/**
+ * @return the descriptor of the given file opened for reading and writing if
+ *         it has the given header and size, -1 otherwise.
+ */
+int _openMatching(const std::string& filename, const Header& header,
+                  const size_t size)
+{
+    const int fd = ::open(filename.c_str(), O_RDWR);
+    if (fd < 0)
+        return -1;
+
+    struct stat info;
+    Header existing;
+    if (::fstat(fd, &info) == 0 && size_t(info.st_size) == size &&
+        ::pread(fd, &existing, sizeof(Header), 0) == sizeof(Header) &&
+        ::memcmp(&existing, &header, sizeof(Header)) == 0)
+    {
+        return fd;
+    }
+    ::close(fd);
+    return -1;
+}
+}
+
+class ValueCache::Impl
+{
+public:
+    Impl()
+        : fd(-1)
+        , data(nullptr)
+        , size(0)
+    {
+    }
+
+    ~Impl() { close(); }
+    void close()
+    {
+        if (data)
+            ::munmap(data, size);
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+        data = nullptr;
+        size = 0;
+    }
+
+    const Frame* getFrame(const uint32_t frame) const
+    {
+        if (!data || frame < header.frameRange[0] ||
+            frame >= header.frameRange[1])
+        {
+            return nullptr;
+        }
+        return reinterpret_cast<const Frame*>(
+                   static_cast<const uint8_t*>(data) + sizeof(Header)) +
+               frame - header.frameRange[0];
+    }
+
+    off_t getFrameOffset(const uint32_t frame) const
+    {
+        return header.dataOffset +
+               (frame - header.frameRange[0]) * header.frameSize;
+    }
+
+    const void* getFrameData(const uint32_t frame) const
+    {
+        return static_cast<const uint8_t*>(data) + getFrameOffset(frame);
+    }
+
+    int fd;
+    void* data; // read-only mapping of the file, written with pwrite()
+    size_t size;
+    Header header;
+};
+
+ValueCache::ValueCache()
+    : _impl(new Impl)
+{
+}
+
+ValueCache::~ValueCache()
+{
+}
+
+uint64_t ValueCache::computeHash(const EventSource& source,
+                                 const std::string& parameters)
+{
+    // the time step maps the frames to the report
+    const double dt = source.getDt();
+    uint64_t hash =
+        kernels::hashWords(&dt, 2, source.getGeometry()->computeHash());
+    for (const char c : parameters)
+        hash = kernels::hashValue(uint8_t(c), hash);
+    return hash;
+}
+
+bool ValueCache::open(const std::string& filename, const uint64_t hash,
+                      const size_t numEvents, const Vector2ui& frameRange,
+                      const bool quantize)
+{
+    close();
+    if (frameRange[1] < frameRange[0])
+        return false;
+    const size_t numFrames = frameRange[1] - frameRange[0];
+
+    Header header;
+    ::memset(&header, 0, sizeof(Header));
+    header.magic = _magic;
+    header.version = _version;
+    header.hash = hash;
+    header.numEvents = numEvents;
+    header.frameRange[0] = frameRange[0];
+    header.frameRange[1] = frameRange[1];
+    header.quantized = quantize;
+    header.frameSize = _align(numEvents * (quantize ? sizeof(uint16_t)
+                                                    : sizeof(float)),
+                              _frameAlignment);
+    header.dataOffset =
+        _align(sizeof(Header) + numFrames * sizeof(Frame), _dataAlignment);
+    const size_t size = header.dataOffset + numFrames * header.frameSize;
+
+    int fd = _openMatching(filename, header, size);
+    if (fd < 0)
+    {
+        // a new file replaces a mismatching one only once complete, so
+        // processes which mapped the old file keep using it
+        const std::string tmpName =
+            filename + "." + std::to_string(::getpid()) + ".tmp";
+        const int tmp = ::open(tmpName.c_str(), O_RDWR | O_CREAT | O_TRUNC,
+                               0644);
+
+        // the frames are only allocated when they are written
+        const bool created = tmp >= 0 && ::ftruncate(tmp, size) == 0 &&
+                             _write(tmp, &header, sizeof(Header), 0) &&
+                             ::fdatasync(tmp) == 0 &&
+                             ::rename(tmpName.c_str(), filename.c_str()) == 0;
+        if (!created)
+        {
+            LBWARN << "Cannot create value cache " << filename << ": "
+                   << ::strerror(errno) << std::endl;
+            if (tmp >= 0)
+            {
+                ::close(tmp);
+                ::unlink(tmpName.c_str());
+            }
+            return false;
+        }
+        ::close(tmp);
+        LBINFO << "Created value cache " << filename << " for " << numFrames
+               << " frames of " << numEvents << " events" << std::endl;
+
+        // the file of a concurrent process may have replaced this one
+        fd = _openMatching(filename, header, size);
+        if (fd < 0)
+        {
+            LBWARN << "Cannot open value cache " << filename << ": "
+                   << ::strerror(errno) << std::endl;
+            return false;
+        }
+    }
+
+    void* data = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    _impl->fd = fd;
+    _impl->data = data;
+    _impl->size = size;
+    _impl->header = header;
+    return true;
+}
+
+void ValueCache::close()
+{
+    _impl->close();
+}
+
+bool ValueCache::isOpen() const
+{
+    return _impl->data != nullptr;
+}
+
+bool ValueCache::hasFrame(const uint32_t frame) const
+{
+    const Frame* entry = _impl->getFrame(frame);
+    return entry && entry->written;
+}
+
+const float* ValueCache::getValues(const uint32_t frame) const
+{
+    if (_impl->header.quantized || !hasFrame(frame))
+        return nullptr;
+    return static_cast<const float*>(_impl->getFrameData(frame));
+}
+
+bool ValueCache::read(const uint32_t frame, float* values) const
+{
+    if (!hasFrame(frame))
+        return false;
+
+    const size_t numEvents = _impl->header.numEvents;
+    if (!_impl->header.quantized)
+    {
+        ::memcpy(values, _impl->getFrameData(frame),
+                 numEvents * sizeof(float));
+        return true;
+    }
+
+    const Frame& entry = *_impl->getFrame(frame);
+    const uint16_t* quantized =
+        static_cast<const uint16_t*>(_impl->getFrameData(frame));
+    for (size_t i = 0; i < numEvents; ++i)
+        values[i] = entry.offset + quantized[i] * entry.scale;
+    return true;
+}
+
+bool ValueCache::write(const uint32_t frame, const float* values)
+{
+    if (!_impl->getFrame(frame))
+        return false;
+
+    const size_t numEvents = _impl->header.numEvents;
+    const off_t offset = _impl->getFrameOffset(frame);
+    Frame entry = {1, 0.f, 0.f, 0};
+    bool written;
+    if (_impl->header.quantized)
+    {
+        // uniform quantization of the range of the frame, with an error of
+        // at most half a step
+        const auto range = std::minmax_element(values, values + numEvents);
+        if (numEvents > 0)
+        {
+            entry.offset = *range.first;
+            entry.scale = (*range.second - *range.first) / _maxQuantized;
+        }
+        const float invScale = entry.scale > 0.f ? 1.f / entry.scale : 0.f;
+
+        std::vector<uint16_t> quantized(numEvents);
+        for (size_t i = 0; i < numEvents; ++i)
+            quantized[i] = std::lround((values[i] - entry.offset) * invScale);
+        written = _write(_impl->fd, quantized.data(),
+                         numEvents * sizeof(uint16_t), offset);
+    }
+    else
+        written = _write(_impl->fd, values, numEvents * sizeof(float), offset);
+
+    // the frame is marked as written only once its values are complete and
+    // stored, so that the flag does not survive a crash without them
+    const off_t entryOffset =
+        sizeof(Header) + (frame - _impl->header.frameRange[0]) * sizeof(Frame);
+    if (!written || ::fdatasync(_impl->fd) != 0 ||
+        !_write(_impl->fd, &entry, sizeof(Frame), entryOffset))
+    {
+        LBWARN << "Cannot write frame " << frame << " to value cache: "
+               << ::strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+}
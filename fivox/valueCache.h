@@ -0,0 +1,117 @@
+/* Copyright (c) 2017, EPFL/Blue Brain Project
+ *
+ * This file is part of Fivox <https://github.com/BlueBrain/Fivox>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef FIVOX_VALUECACHE_H
+#define FIVOX_VALUECACHE_H
+
+#include <fivox/api.h>
+#include <fivox/types.h>
+
+#include <memory> // member
+
+namespace fivox
+{
+/**
+ * File of the event values of each frame of a source, to replay frames
+ * without loading them again from their report.
+ *
+ * The file holds one block of values per frame of the source, either as 32
+ * bit floats or quantized to 16 bit with an offset and scale per frame.
+ * Frames are written as they are loaded, and read from the memory-mapped
+ * file afterwards, also by later runs for the same events and frames.
+ */
+class ValueCache
+{
+public:
+    FIVOX_API ValueCache();
+    FIVOX_API ~ValueCache();
+
+    /**
+     * @return a hash of the number, positions and radii of the events, of
+     *         the time step and of the given parameters, which identifies the
+     *         values a cache was written for.
+     *
+     * @param source the events.
+     * @param parameters the parameters which determine the values, e.g. the
+     *        data source and the options of the loader.
+     */
+    FIVOX_API static uint64_t computeHash(const EventSource& source,
+                                          const std::string& parameters);
+
+    /**
+     * Open the cache file, or create it if it does not exist or was written
+     * for other events, frames or quantization. A new file is written under
+     * a temporary name and renamed once complete, so other processes keep
+     * the file they opened.
+     *
+     * @param filename the cache file.
+     * @param hash the hash of the events, see computeHash().
+     * @param numEvents the number of values per frame.
+     * @param frameRange the frames of the source, open on the right.
+     * @param quantize store the values with 16 bit instead of 32 bit.
+     * @return false if the file could not be opened nor created.
+     */
+    FIVOX_API bool open(const std::string& filename, uint64_t hash,
+                        size_t numEvents, const Vector2ui& frameRange,
+                        bool quantize);
+
+    /** Close the file, isOpen() returns false afterwards. */
+    FIVOX_API void close();
+
+    /** @return true if a file is open. */
+    FIVOX_API bool isOpen() const;
+
+    /** @return true if the values of the given frame are in the file. */
+    FIVOX_API bool hasFrame(uint32_t frame) const;
+
+    /**
+     * @return the values of the given frame in the read-only file mapping,
+     *         or nullptr if the frame is not in the file or the values are
+     *         quantized.
+     */
+    FIVOX_API const float* getValues(uint32_t frame) const;
+
+    /**
+     * Read the values of the given frame.
+     *
+     * @param frame the frame to read.
+     * @param values the output values, one per event.
+     * @return false if the frame is not in the file.
+     */
+    FIVOX_API bool read(uint32_t frame, float* values) const;
+
+    /**
+     * Write the values of the given frame to the file.
+     *
+     * @param frame the frame to write.
+     * @param values the values, one per event.
+     * @return false if the frame is out of the range of the file or the
+     *         file could not be written.
+     */
+    FIVOX_API bool write(uint32_t frame, const float* values);
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> _impl;
+
+    ValueCache(const ValueCache&) = delete;
+    ValueCache& operator=(const ValueCache&) = delete;
+};
+}
+
+#endif
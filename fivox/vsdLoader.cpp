@@ -32,6 +32,7 @@
 #include <brion/brion.h>
 
 #include <cassert>
+#include <sstream>
 
 namespace fivox
 {
@@ -45,19 +46,14 @@ public:
         , _voltageReport(params.getConfig().getReportSource(params.getReport()),
                          brion::MODE_READ, _gids)
         , _areaReport(URI(params.getAreas()), brion::MODE_READ, _gids)
+        , _frames(_voltageReport, params.getReadAhead())
         , _restingPotential(0.f)
         , _areaMultiplier(0.f)
         , _spikeFilter(false)
         , _apThreshold(0.f)
         , _interpolate(false)
     {
-        LBINFO << "Loading " << _gids.size() << " morphologies..." << std::endl;
-        const auto morphologies =
-            _circuit.loadMorphologies(_gids,
-                                      brain::Circuit::Coordinates::global);
-
-        LBINFO << "Creating events..." << std::endl;
-        helpers::addCompartmentEvents(morphologies, _voltageReport, _output);
+        helpers::addCompartmentEvents(params, _voltageReport, _output);
 
         LBINFO << "Loading areas..." << std::endl;
         _areas = _areaReport.loadFrame(0.).get();
@@ -65,8 +61,7 @@ public:
 
     ssize_t load()
     {
-        brion::floatsPtr voltages =
-            _voltageReport.loadFrame(_output.getCurrentTime()).get();
+        brion::floatsPtr voltages = _frames.load(_output);
         if (!voltages)
             return -1;
 
@@ -75,12 +70,14 @@ public:
                 std::runtime_error("The number of compartments in the "
                                    "voltage report doesn't match the "
                                    "number of areas"));
+        const uint32_t* order = _output.getGeometry()->getOrder();
         for (size_t i = 0; i != voltages->size(); ++i)
         {
-            const float voltage = (*voltages)[i];
+            const size_t j = order ? order[i] : i;
+            const float voltage = (*voltages)[j];
             _updateEventValue(i, _spikeFilter ? std::min(voltage, _apThreshold)
                                               : voltage,
-                              (*_areas)[i]);
+                              (*_areas)[j]);
         }
         return voltages->size();
     }
@@ -102,6 +99,7 @@ public:
 
     brion::CompartmentReport _voltageReport;
     brion::CompartmentReport _areaReport;
+    helpers::FramePrefetcher _frames;
     brion::floatsPtr _areas;
     AttenuationCurve _curve;
 
@@ -196,4 +194,18 @@ ssize_t VSDLoader::_load(const size_t /*chunkIndex*/,
 {
     return _impl->load();
 }
+
+std::string VSDLoader::_getValueOptions() const
+{
+    std::ostringstream options;
+    options.precision(17);
+    options << _impl->_restingPotential << ":" << _impl->_areaMultiplier
+            << ":" << _impl->_spikeFilter << ":" << _impl->_apThreshold << ":"
+            << _impl->_interpolate << ":" << _impl->_sigma << ":"
+            << _impl->_yOrigin << ":" << _impl->_circuitHeight << ":"
+            << _impl->_curve.getThickness();
+    for (const float attenuation : _impl->_curve.getCurve())
+        options << ":" << attenuation;
+    return options.str();
+}
 }
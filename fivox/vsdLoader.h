@@ -127,6 +127,8 @@ private:
     size_t _getNumChunks() const final { return 1; }
     //@}
 
+    std::string _getValueOptions() const final;
+
     class Impl;
     std::unique_ptr<Impl> _impl;
 };
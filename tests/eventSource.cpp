@@ -0,0 +1,272 @@
+
+/* Copyright (c) 2017, EPFL/Blue Brain Project
+ *
+ * This file is part of Fivox <https://github.com/BlueBrain/Fivox>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of Eyescale Software GmbH nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define BOOST_TEST_MODULE EventSource
+
+#include "randomSource.h"
+#include "test.h"
+#include <fivox/eventGeometry.h>
+
+#include <algorithm>
+#include <thread>
+
+BOOST_AUTO_TEST_CASE(EventSourceFindEvents)
+{
+    const fivox::URIHandler params(fivox::URI("fivox://"));
+    RandomSource source(params);
+
+    std::mt19937 generator(7);
+    std::uniform_real_distribution<float> position(-10.f, _extent + 10.f);
+    std::uniform_real_distribution<float> size(0.f, 40.f);
+    std::vector<fivox::AABBf> areas;
+    for (size_t i = 0; i < 100; ++i)
+    {
+        const fivox::Vector3f lower(position(generator), position(generator),
+                                    position(generator));
+        const fivox::Vector3f upper(lower[0] + size(generator),
+                                    lower[1] + size(generator),
+                                    lower[2] + size(generator));
+        areas.push_back(fivox::AABBf(lower, upper));
+    }
+
+    const auto sumAll = [&source](const fivox::AABBf& area) {
+        float sum = 0.f;
+        for (size_t i = 0; i < source.getNumEvents(); ++i)
+        {
+            const fivox::Vector3f pos(source.getPositionsX()[i],
+                                      source.getPositionsY()[i],
+                                      source.getPositionsZ()[i]);
+            if (pos[0] >= area.getMin()[0] && pos[0] <= area.getMax()[0] &&
+                pos[1] >= area.getMin()[1] && pos[1] <= area.getMax()[1] &&
+                pos[2] >= area.getMin()[2] && pos[2] <= area.getMax()[2])
+            {
+                sum += source.getValues()[i];
+            }
+        }
+        return sum;
+    };
+    const auto sum = [](const fivox::EventValues& values, const size_t begin,
+                        const size_t end) {
+        float result = 0.f;
+        for (size_t i = begin; i < end; ++i)
+            result += values[i];
+        return result;
+    };
+
+    // without and with index
+    for (size_t i = 0; i < 2; ++i)
+    {
+        if (i == 1)
+            source.buildIndex();
+
+        fivox::EventValues values;
+        std::vector<size_t> offsets;
+        source.findEvents(areas, values, offsets);
+        BOOST_REQUIRE_EQUAL(offsets.size(), areas.size() + 1);
+
+        for (size_t j = 0; j < areas.size(); ++j)
+        {
+            const fivox::EventValues& single = source.findEvents(areas[j]);
+            BOOST_CHECK_EQUAL(single.size(), offsets[j + 1] - offsets[j]);
+            BOOST_CHECK_CLOSE(sum(single, 0, single.size()),
+                              sumAll(areas[j]), 0.01f /*%*/);
+            BOOST_CHECK_CLOSE(sum(values, offsets[j], offsets[j + 1]),
+                              sumAll(areas[j]), 0.01f /*%*/);
+
+            // allocation-free queries
+            BOOST_CHECK_CLOSE(source.sumValues(areas[j]), sumAll(areas[j]),
+                              0.01f /*%*/);
+            const float lowest = -100.f;
+            BOOST_CHECK_EQUAL(source.maxValue(areas[j], lowest),
+                              single.empty() ? lowest
+                                             : *std::max_element(
+                                                   single.begin(),
+                                                   single.end()));
+            size_t count = 0;
+            source.forEachEvent(areas[j], [&count](size_t) { ++count; });
+            BOOST_CHECK_EQUAL(count, single.size());
+        }
+    }
+
+    // the index returns the current values
+    source[0] = 1000.f;
+    const fivox::Vector3f pos(source.getPositionsX()[0],
+                              source.getPositionsY()[0],
+                              source.getPositionsZ()[0]);
+    const fivox::EventValues& values =
+        source.findEvents(fivox::AABBf(pos, pos));
+    BOOST_CHECK(std::find(values.begin(), values.end(), 1000.f) !=
+                values.end());
+}
+
+BOOST_AUTO_TEST_CASE(EventGeometrySharing)
+{
+    const fivox::URIHandler params(fivox::URI("fivox://"));
+    RandomSource source1(params);
+    RandomSource source2(params);
+
+    size_t numCreated = 0;
+    const auto create = [&] {
+        ++numCreated;
+        return source1.getGeometry();
+    };
+    source2.setGeometry(fivox::EventGeometry::getShared("random", create));
+    BOOST_CHECK_EQUAL(fivox::EventGeometry::getShared("random", create),
+                      source2.getGeometry());
+    BOOST_CHECK_EQUAL(numCreated, 1);
+
+    // the registry is not locked while creating, e.g. from other geometries
+    const auto createNested = [&] {
+        return fivox::EventGeometry::getShared("random", create);
+    };
+    BOOST_CHECK_EQUAL(fivox::EventGeometry::getShared("nested", createNested),
+                      source2.getGeometry());
+    BOOST_CHECK_EQUAL(numCreated, 1);
+
+    // one copy of the positions and of the index, separate values
+    BOOST_CHECK_EQUAL(source1.getPositionsX(), source2.getPositionsX());
+    BOOST_CHECK_EQUAL(source2.getValues()[0], 0.f);
+    source2[0] = 1.f;
+    BOOST_CHECK_NE(source1.getValues()[0], 1.f);
+    source1.buildIndex();
+    BOOST_CHECK(source2.getGeometry()->hasIndex());
+
+    // copy on write
+    const float x = source1.getPositionsX()[0];
+    source2.update(0, fivox::Vector3f(-1.f), 1.f, 1.f);
+    BOOST_CHECK_NE(source1.getPositionsX(), source2.getPositionsX());
+    BOOST_CHECK_EQUAL(source1.getPositionsX()[0], x);
+    BOOST_CHECK_EQUAL(source2.getPositionsX()[0], -1.f);
+    BOOST_CHECK(source1.getGeometry()->hasIndex());
+    BOOST_CHECK(!source2.getGeometry()->hasIndex());
+}
+
+BOOST_AUTO_TEST_CASE(EventSourceRangeUpdate)
+{
+    const fivox::URIHandler params(fivox::URI("fivox://"));
+    RandomSource source(params);
+    const size_t numEvents = source.getNumEvents();
+    std::vector<float> radii(numEvents);
+    for (size_t i = 0; i < numEvents; ++i)
+        radii[i] = 1.f / source.getRadii()[i];
+
+    // same events, set by concurrent updates of disjoint ranges
+    RandomSource ranges(params);
+    ranges.resize(numEvents);
+    std::vector<std::thread> threads;
+    const size_t numThreads = 4;
+    for (size_t i = 0; i < numThreads; ++i)
+    {
+        const size_t first = numEvents * i / numThreads;
+        const size_t count = numEvents * (i + 1) / numThreads - first;
+        threads.emplace_back([&, first, count] {
+            ranges.update(first, count, source.getPositionsX() + first,
+                          source.getPositionsY() + first,
+                          source.getPositionsZ() + first, radii.data() + first,
+                          source.getValues() + first);
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    BOOST_CHECK_EQUAL_COLLECTIONS(ranges.getPositionsX(),
+                                  ranges.getPositionsX() + numEvents,
+                                  source.getPositionsX(),
+                                  source.getPositionsX() + numEvents);
+    BOOST_CHECK_EQUAL_COLLECTIONS(ranges.getValues(),
+                                  ranges.getValues() + numEvents,
+                                  source.getValues(),
+                                  source.getValues() + numEvents);
+    for (size_t i = 0; i < numEvents; ++i)
+        BOOST_CHECK_CLOSE(ranges.getRadii()[i], source.getRadii()[i], 0.001f);
+    BOOST_CHECK_EQUAL(ranges.getGeometry()->getBoundingBox(),
+                      source.getGeometry()->getBoundingBox());
+
+    BOOST_CHECK_THROW(ranges.update(numEvents, 1, radii.data(), radii.data(),
+                                    radii.data(), nullptr, nullptr),
+                      std::out_of_range);
+}
+
+BOOST_AUTO_TEST_CASE(EventSourceAdoptValues)
+{
+    const fivox::URIHandler params(fivox::URI("fivox://"));
+    RandomSource source(params);
+    auto frame = std::make_shared<std::vector<float>>(source.getNumEvents(),
+                                                      1.f);
+
+    // used in place, and copied on the first change
+    source.adoptValues(frame->data(), frame);
+    BOOST_CHECK_EQUAL(source.getValues(), frame->data());
+    BOOST_CHECK_EQUAL(frame.use_count(), 2);
+
+    source[1] = 2.f;
+    BOOST_CHECK_NE(source.getValues(), frame->data());
+    BOOST_CHECK_EQUAL(frame.use_count(), 1);
+    BOOST_CHECK_EQUAL(source.getValues()[0], 1.f);
+    BOOST_CHECK_EQUAL(source.getValues()[1], 2.f);
+    BOOST_CHECK_EQUAL((*frame)[1], 1.f);
+}
+
+BOOST_AUTO_TEST_CASE(EventGeometrySortSpatially)
+{
+    const fivox::URIHandler params(fivox::URI("fivox://"));
+    RandomSource source(params);
+    const fivox::EventGeometry& events = *source.getGeometry();
+    fivox::EventGeometry sorted(events);
+    BOOST_CHECK(!sorted.getOrder());
+    sorted.sortSpatially();
+
+    // a permutation of the events, with closer neighbors in memory
+    const uint32_t* order = sorted.getOrder();
+    BOOST_REQUIRE(order);
+    std::vector<bool> found(_numEvents);
+    float distance = 0.f;
+    float sortedDistance = 0.f;
+    for (size_t i = 0; i < _numEvents; ++i)
+    {
+        const size_t j = order[i];
+        BOOST_REQUIRE_LT(j, _numEvents);
+        BOOST_CHECK(!found[j]);
+        found[j] = true;
+        BOOST_CHECK_EQUAL(sorted.getPositionsX()[i], events.getPositionsX()[j]);
+        BOOST_CHECK_EQUAL(sorted.getPositionsY()[i], events.getPositionsY()[j]);
+        BOOST_CHECK_EQUAL(sorted.getPositionsZ()[i], events.getPositionsZ()[j]);
+        BOOST_CHECK_EQUAL(sorted.getRadii()[i], events.getRadii()[j]);
+        if (i == 0)
+            continue;
+
+        distance += std::abs(events.getPositionsX()[i] -
+                             events.getPositionsX()[i - 1]);
+        sortedDistance += std::abs(sorted.getPositionsX()[i] -
+                                   sorted.getPositionsX()[i - 1]);
+    }
+    BOOST_CHECK_LT(sortedDistance, distance / 4.f);
+    BOOST_CHECK_EQUAL(sorted.getBoundingBox(), events.getBoundingBox());
+}
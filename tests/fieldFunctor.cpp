@@ -0,0 +1,554 @@
+
+/* Copyright (c) 2017, EPFL/Blue Brain Project
+ *
+ * This file is part of Fivox <https://github.com/BlueBrain/Fivox>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of Eyescale Software GmbH nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define BOOST_TEST_MODULE FieldFunctor
+
+#include "randomSource.h"
+#include "test.h"
+#include <fivox/approximateFieldFunctor.h>
+#include <fivox/binningImageSource.h>
+#include <fivox/convolutionImageSource.h>
+#include <fivox/densityFunctor.h>
+#include <fivox/eventSource.h>
+#include <fivox/fieldFunctor.h>
+#include <fivox/frequencyFunctor.h>
+#include <fivox/functorImageSource.h>
+#include <fivox/influenceMatrixImageSource.h>
+#include <fivox/kernels.h>
+#include <fivox/uriHandler.h>
+
+#include <itkTimeProbe.h>
+
+namespace
+{
+const size_t _numChunks = 4; // of ChunkedSource
+const size_t _size = 32;
+const float _maxCutoffValue = 80.f / (50.f * 50.f); // event at cutoff=50
+
+/** Events of another source, loaded in chunks with selectEvents() */
+class ChunkedSource : public fivox::EventSource
+{
+public:
+    ChunkedSource(const fivox::URIHandler& params,
+                  const fivox::EventSource& from)
+        : fivox::EventSource(params)
+    {
+        setGeometry(from.getGeometry());
+        for (size_t i = 0; i < getNumEvents(); ++i)
+            (*this)[i] = from.getValues()[i];
+    }
+
+private:
+    fivox::Vector2f _getTimeRange() const final
+    {
+        return fivox::Vector2f(0.f, 1.f);
+    }
+    ssize_t _load(const size_t chunkIndex, const size_t numChunks) final
+    {
+        const size_t chunkSize = _numEvents / _numChunks;
+        selectEvents(chunkIndex * chunkSize, numChunks * chunkSize);
+        return getNumEvents();
+    }
+    fivox::SourceType _getType() const final
+    {
+        return fivox::SourceType::frame;
+    }
+    size_t _getNumChunks() const final { return _numChunks; }
+};
+
+/** Straight loop over all events, as done originally by the FieldFunctor */
+float _sampleAll(const fivox::EventSource& source, const float* point)
+{
+    const float cutoff = source.getCutOffDistance();
+    float voltage = 0.f;
+    for (size_t i = 0; i < source.getNumEvents(); ++i)
+    {
+        const float dx = point[0] - source.getPositionsX()[i];
+        const float dy = point[1] - source.getPositionsY()[i];
+        const float dz = point[2] - source.getPositionsZ()[i];
+        const float distance2 = dx * dx + dy * dy + dz * dz;
+        if (distance2 > cutoff * cutoff)
+            continue;
+
+        const float radius = source.getRadii()[i];
+        const float value = source.getValues()[i];
+        if (1.f / distance2 > radius * radius)
+            voltage += value * radius;
+        else
+            voltage += value / distance2;
+    }
+    return voltage;
+}
+
+template <typename TImage>
+void _setGeometry(typename TImage::Pointer output)
+{
+    _setSize<TImage>(output, _size);
+
+    typename TImage::SpacingType spacing;
+    spacing.Fill(_extent / _size);
+    output->SetSpacing(spacing);
+
+    typename TImage::PointType origin;
+    origin.Fill(0.);
+    output->SetOrigin(origin);
+}
+
+template <typename TImage>
+typename TImage::Pointer _voxelize(
+    fivox::EventSourcePtr source, fivox::EventFunctorPtr<TImage> functor,
+    const fivox::SamplingMode mode = fivox::SamplingMode::gather)
+{
+    typedef fivox::FunctorImageSource<TImage> Filter;
+    typename Filter::Pointer filter = Filter::New();
+    typename TImage::Pointer output = filter->GetOutput();
+    _setGeometry<TImage>(output);
+
+    functor->setEventSource(source);
+    filter->setFunctor(functor);
+    filter->setSamplingMode(mode);
+    filter->setEventSource(source);
+    filter->Update();
+    return output;
+}
+
+/** Call f(index) for each voxel of an image of _setGeometry() */
+template <typename TImage, typename F>
+void _forEachVoxel(const F& f)
+{
+    typename TImage::IndexType index;
+    for (index[2] = 0; index[2] < long(_size); ++index[2])
+        for (index[1] = 0; index[1] < long(_size); ++index[1])
+            for (index[0] = 0; index[0] < long(_size); ++index[0])
+                f(index);
+}
+
+/**
+ * Check each voxel of the output against the expected image, within a
+ * relative error of 1e-5 and the given absolute error.
+ */
+template <typename TImage>
+void _checkVoxels(const TImage& output, const TImage& expected,
+                  const float absolute = _maxCutoffValue)
+{
+    _forEachVoxel<TImage>([&](const typename TImage::IndexType& index) {
+        const float value = expected.GetPixel(index);
+        BOOST_CHECK_SMALL(output.GetPixel(index) - value,
+                          std::abs(value) * 1e-5f + absolute);
+    });
+}
+
+/**
+ * Check that the functor samples new values and positions of the same number
+ * of events, set without beforeGenerate(), from the source and not from the
+ * events it binned for the first volume.
+ */
+void _checkStaleEvents(fivox::EventFunctorPtr<fivox::FloatVolume> functor)
+{
+    const fivox::URIHandler params(fivox::URI("fivox://?cutoff=50"));
+    auto source = std::make_shared<RandomSource>(params);
+
+    typedef fivox::FloatVolume Image;
+    Image::Pointer output = _voxelize<Image>(source, functor);
+
+    Image::PointType point;
+    point.Fill(_extent * 0.5f);
+    const float position[] = {float(point[0]), float(point[1]),
+                              float(point[2])};
+    BOOST_CHECK_CLOSE((*functor)(point, output->GetSpacing()),
+                      _sampleAll(*source, position), 0.01f /*%*/);
+
+    std::vector<float> values(source->getValues(),
+                              source->getValues() + _numEvents);
+    for (float& value : values)
+        value *= 2.f;
+    source->update(0, _numEvents, source->getPositionsX(),
+                   source->getPositionsY(), source->getPositionsZ(), nullptr,
+                   values.data());
+    BOOST_CHECK_CLOSE((*functor)(point, output->GetSpacing()),
+                      _sampleAll(*source, position), 0.01f /*%*/);
+
+    source->update(0, fivox::Vector3f(position[0] + 10.f, position[1],
+                                      position[2]),
+                   1.f, -50.f);
+    BOOST_CHECK_CLOSE((*functor)(point, output->GetSpacing()),
+                      _sampleAll(*source, position), 0.01f /*%*/);
+}
+}
+
+BOOST_AUTO_TEST_CASE(FieldFunctorGridAndLines)
+{
+    const fivox::URIHandler params(fivox::URI("fivox://?cutoff=50"));
+    auto source = std::make_shared<RandomSource>(params);
+
+    typedef fivox::FloatVolume Image;
+    auto functor = std::make_shared<fivox::FieldFunctor<Image>>();
+    Image::Pointer output = _voxelize<Image>(source, functor);
+
+    _forEachVoxel<Image>([&](const Image::IndexType& index) {
+        Image::PointType point;
+        output->TransformIndexToPhysicalPoint(index, point);
+        const float position[] = {float(point[0]), float(point[1]),
+                                  float(point[2])};
+
+        const float expected = _sampleAll(*source, position);
+
+        // line-wise from the image source and per voxel
+        BOOST_CHECK_CLOSE(output->GetPixel(index), expected, 0.01f /*%*/);
+        BOOST_CHECK_CLOSE((*functor)(point, output->GetSpacing()), expected,
+                          0.01f /*%*/);
+    });
+}
+
+BOOST_AUTO_TEST_CASE(FieldFunctorStaleGrid)
+{
+    _checkStaleEvents(
+        std::make_shared<fivox::FieldFunctor<fivox::FloatVolume>>());
+}
+
+BOOST_AUTO_TEST_CASE(ApproximateFieldFunctorStaleTree)
+{
+    // exact with a theta of 0, see ApproximateFieldFunctor
+    _checkStaleEvents(
+        std::make_shared<fivox::ApproximateFieldFunctor<fivox::FloatVolume>>(
+            0.f));
+}
+
+BOOST_AUTO_TEST_CASE(FieldFunctorKernels)
+{
+    const fivox::URIHandler params(fivox::URI("fivox://?cutoff=50"));
+    auto source = std::make_shared<RandomSource>(params);
+
+    typedef fivox::FloatVolume Image;
+    auto functor = std::make_shared<fivox::FieldFunctor<Image>>();
+
+    const fivox::KernelType defaultType = fivox::kernels::getKernelType();
+    BOOST_CHECK(fivox::kernels::isSupported(defaultType));
+
+    fivox::kernels::setKernelType(fivox::KernelType::scalar);
+    Image::Pointer expected = _voxelize<Image>(source, functor);
+
+    for (const fivox::KernelType type :
+         {fivox::KernelType::sse4, fivox::KernelType::avx2,
+          fivox::KernelType::avx512})
+    {
+        if (!fivox::kernels::isSupported(type))
+        {
+            BOOST_CHECK_THROW(fivox::kernels::setKernelType(type),
+                              std::runtime_error);
+            continue;
+        }
+
+        fivox::kernels::setKernelType(type);
+        Image::Pointer output = _voxelize<Image>(source, functor);
+
+        // reciprocal estimates are refined to about 2 ulp, which may move
+        // single events across the cutoff distance
+        _checkVoxels(*output, *expected);
+    }
+    fivox::kernels::setKernelType(defaultType);
+}
+
+BOOST_AUTO_TEST_CASE(FieldFunctorSplat)
+{
+    const fivox::URIHandler params(fivox::URI("fivox://?cutoff=50"));
+    auto source = std::make_shared<RandomSource>(params);
+
+    typedef fivox::FloatVolume Image;
+    auto functor = std::make_shared<fivox::FieldFunctor<Image>>();
+    Image::Pointer expected = _voxelize<Image>(source, functor);
+    Image::Pointer output =
+        _voxelize<Image>(source, functor, fivox::SamplingMode::splat);
+
+    // voxel positions are computed relative to the events
+    _checkVoxels(*output, *expected);
+}
+
+BOOST_AUTO_TEST_CASE(ApproximateFieldFunctor)
+{
+    // all events are within the cutoff distance
+    const fivox::URIHandler params(fivox::URI("fivox://?cutoff=1000"));
+    auto source = std::make_shared<RandomSource>(params);
+
+    typedef fivox::FloatVolume Image;
+    itk::TimeProbe exactClock;
+    exactClock.Start();
+    Image::Pointer expected = _voxelize<Image>(
+        source, std::make_shared<fivox::FieldFunctor<Image>>());
+    exactClock.Stop();
+
+#ifdef NDEBUG
+    std::cout << "theta, max error, time (exact " << exactClock.GetTotal()
+              << "s)" << std::endl;
+#endif
+
+    // maximum relative error per voxel, all values have the same sign
+    const std::pair<float, float> thetaErrors[] = {{0.f, 1e-4f},
+                                                   {0.25f, 0.01f},
+                                                   {0.5f, 0.05f},
+                                                   {1.f, 0.5f}};
+    for (const auto& thetaError : thetaErrors)
+    {
+        auto functor = std::make_shared<fivox::ApproximateFieldFunctor<Image>>(
+            thetaError.first);
+        itk::TimeProbe clock;
+        clock.Start();
+        Image::Pointer output = _voxelize<Image>(source, functor);
+        clock.Stop();
+
+        float maxError = 0.f;
+        _forEachVoxel<Image>([&](const Image::IndexType& index) {
+            const float value = expected->GetPixel(index);
+            const float error = std::abs(output->GetPixel(index) - value);
+            maxError = std::max(maxError, error / std::abs(value));
+        });
+        BOOST_CHECK_LT(maxError, thetaError.second);
+
+#ifdef NDEBUG
+        std::cout << thetaError.first << ", " << maxError << ", "
+                  << clock.GetTotal() << "s" << std::endl;
+#endif
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ConvolutionImageSource)
+{
+    const fivox::URIHandler params(fivox::URI("fivox://?cutoff=100"));
+    auto source = std::make_shared<RandomSource>(params);
+
+    typedef fivox::FloatVolume Image;
+    itk::TimeProbe exactClock;
+    exactClock.Start();
+    Image::Pointer expected = _voxelize<Image>(
+        source, std::make_shared<fivox::FieldFunctor<Image>>());
+    exactClock.Stop();
+
+    typedef fivox::ConvolutionImageSource<Image> Filter;
+    Filter::Pointer filter = Filter::New();
+    Image::Pointer output = filter->GetOutput();
+    _setGeometry<Image>(output);
+    filter->setEventSource(source);
+
+    itk::TimeProbe clock;
+    clock.Start();
+    filter->Update();
+    clock.Stop();
+
+    // events are moved to their nearest voxel for the far field, so the
+    // error is bounded for the whole volume rather than per voxel
+    double error2 = 0.;
+    double value2 = 0.;
+    _forEachVoxel<Image>([&](const Image::IndexType& index) {
+        const float value = expected->GetPixel(index);
+        const float error = output->GetPixel(index) - value;
+        error2 += error * error;
+        value2 += value * value;
+    });
+    const double error = std::sqrt(error2 / value2);
+    BOOST_CHECK_LT(error, 0.05);
+
+#ifdef NDEBUG
+    std::cout << "Convolution: RMS error " << error << ", " << clock.GetTotal()
+              << "s, exact " << exactClock.GetTotal() << "s" << std::endl;
+#endif
+}
+
+BOOST_AUTO_TEST_CASE(InfluenceMatrixImageSource)
+{
+    const fivox::URIHandler params(fivox::URI("fivox://?cutoff=50"));
+    auto source = std::make_shared<RandomSource>(params);
+
+    typedef fivox::FloatVolume Image;
+    typedef fivox::InfluenceMatrixImageSource<Image> Filter;
+    Filter::Pointer filter = Filter::New();
+    Image::Pointer output = filter->GetOutput();
+    _setGeometry<Image>(output);
+    filter->setEventSource(source);
+
+    // the second frame reuses the matrices of the first one
+    for (size_t frame = 0; frame < 2; ++frame)
+    {
+        for (size_t i = 0; i < source->getNumEvents(); ++i)
+            (*source)[i] = -80.f * ((i + frame) % 7) / 6.f;
+
+        filter->Modified();
+        filter->Update();
+        Image::Pointer expected = _voxelize<Image>(
+            source, std::make_shared<fivox::FieldFunctor<Image>>());
+        _checkVoxels(*output, *expected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(FieldFunctorDeltas)
+{
+    const fivox::URIHandler params(fivox::URI("fivox://?cutoff=50"));
+    auto source = std::make_shared<RandomSource>(params);
+
+    typedef fivox::FloatVolume Image;
+    typedef fivox::FunctorImageSource<Image> Filter;
+    Filter::Pointer filter = Filter::New();
+    Image::Pointer output = filter->GetOutput();
+    _setGeometry<Image>(output);
+    auto functor = std::make_shared<fivox::FieldFunctor<Image>>();
+    functor->setEventSource(source);
+    filter->setFunctor(functor);
+    filter->setEventSource(source);
+    filter->setDeltaTolerance(0.f);
+
+    // full volume, 10% of the events changed, all changed
+    for (const size_t step : {1, 10, 1})
+    {
+        for (size_t i = 0; i < source->getNumEvents(); i += step)
+            (*source)[i] *= 0.5f;
+
+        filter->Modified();
+        filter->Update();
+        Image::Pointer expected = _voxelize<Image>(
+            source, std::make_shared<fivox::FieldFunctor<Image>>());
+        _checkVoxels(*output, *expected);
+    }
+
+    // an event moved in place recomputes the volume
+    source->update(0, fivox::Vector3f(_extent * 0.5f), 1.f, -50.f);
+    filter->Modified();
+    filter->Update();
+    Image::Pointer expected = _voxelize<Image>(
+        source, std::make_shared<fivox::FieldFunctor<Image>>());
+    _checkVoxels(*output, *expected);
+}
+
+BOOST_AUTO_TEST_CASE(FieldFunctorChunks)
+{
+    const fivox::URIHandler params(fivox::URI("fivox://?cutoff=50"));
+    auto source = std::make_shared<RandomSource>(params);
+    auto chunked = std::make_shared<ChunkedSource>(params, *source);
+
+    typedef fivox::FloatVolume Image;
+    typedef fivox::FunctorImageSource<Image> Filter;
+    Filter::Pointer filter = Filter::New();
+    Image::Pointer output = filter->GetOutput();
+    _setGeometry<Image>(output);
+    auto functor = std::make_shared<fivox::FieldFunctor<Image>>();
+    functor->setEventSource(chunked);
+    filter->setFunctor(functor);
+    filter->setEventSource(chunked);
+    filter->setChunkedLoading(true);
+    filter->Update();
+    BOOST_CHECK_EQUAL(chunked->getNumEvents(),
+                      _numEvents / _numChunks);
+
+    Image::Pointer expected = _voxelize<Image>(
+        source, std::make_shared<fivox::FieldFunctor<Image>>());
+    _checkVoxels(*output, *expected, 1e-6f);
+
+    BOOST_CHECK_THROW(chunked->selectEvents(_numEvents, 1), std::out_of_range);
+}
+
+BOOST_AUTO_TEST_CASE(DensityFunctorThreads)
+{
+    const fivox::URIHandler params(fivox::URI("fivox://"));
+    auto source = std::make_shared<RandomSource>(params);
+    source->buildIndex();
+
+    typedef fivox::FloatVolume Image;
+    typedef fivox::FunctorImageSource<Image> Filter;
+
+    // concurrent sumValues() queries give the sums of the findEvents() values
+    for (const size_t numThreads : {1, 8, 64})
+    {
+        Filter::Pointer filter = Filter::New();
+        Image::Pointer output = filter->GetOutput();
+        _setGeometry<Image>(output);
+        auto functor = std::make_shared<fivox::DensityFunctor<Image>>();
+        functor->setEventSource(source);
+        filter->setFunctor(functor);
+        filter->setEventSource(source);
+        filter->SetNumberOfThreads(numThreads);
+        filter->Update();
+
+        const fivox::Vector3f spacing_2(_extent / _size * 0.5f);
+        const float volume = spacing_2.product() * 8.f;
+        _forEachVoxel<Image>([&](const Image::IndexType& index) {
+            Image::PointType point;
+            output->TransformIndexToPhysicalPoint(index, point);
+            const fivox::Vector3f center(point[0], point[1], point[2]);
+            float sum = 0.f;
+            for (const float value : source->findEvents(
+                     fivox::AABBf(center - spacing_2, center + spacing_2)))
+            {
+                sum += value;
+            }
+            BOOST_CHECK_CLOSE(output->GetPixel(index), sum / volume,
+                              0.001f /*%*/);
+        });
+    }
+}
+
+BOOST_AUTO_TEST_CASE(BinningImageSource)
+{
+    const fivox::URIHandler params(fivox::URI("fivox://"));
+    auto source = std::make_shared<RandomSource>(params);
+
+    typedef fivox::FloatVolume Image;
+    typedef fivox::BinningImageSource<Image> Filter;
+    for (const fivox::FunctorType type :
+         {fivox::FunctorType::density, fivox::FunctorType::frequency})
+    {
+        Filter::Pointer filter = Filter::New();
+        Image::Pointer output = filter->GetOutput();
+        _setGeometry<Image>(output);
+        filter->setFunctorType(type);
+        filter->setEventSource(source);
+        filter->Update();
+
+        fivox::EventFunctorPtr<Image> functor;
+        if (type == fivox::FunctorType::density)
+            functor = std::make_shared<fivox::DensityFunctor<Image>>();
+        else
+            functor = std::make_shared<fivox::FrequencyFunctor<Image>>();
+        Image::Pointer expected = _voxelize<Image>(source, functor);
+
+        // events on the boundary of two voxels are only binned in one
+        size_t numDifferent = 0;
+        _forEachVoxel<Image>([&](const Image::IndexType& index) {
+            const float value = expected->GetPixel(index);
+            if (std::abs(output->GetPixel(index) - value) >
+                std::abs(value) * 1e-5f)
+            {
+                ++numDifferent;
+            }
+        });
+        BOOST_CHECK_LT(numDifferent, _size * _size * _size / 1000);
+    }
+
+    BOOST_CHECK_THROW(Filter::New()->setFunctorType(
+                          fivox::FunctorType::field),
+                      std::invalid_argument);
+}
@@ -0,0 +1,74 @@
+
+/* Copyright (c) 2017, EPFL/Blue Brain Project
+ *
+ * This file is part of Fivox <https://github.com/BlueBrain/Fivox>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of Eyescale Software GmbH nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <fivox/eventSource.h>
+#include <fivox/uriHandler.h>
+
+#include <random>
+
+namespace
+{
+const size_t _numEvents = 5000;
+const float _extent = 400.f; // micrometers
+
+/** Uniformly distributed events with voltage-like values */
+class RandomSource : public fivox::EventSource
+{
+public:
+    explicit RandomSource(const fivox::URIHandler& params)
+        : fivox::EventSource(params)
+    {
+        std::mt19937 generator(42);
+        std::uniform_real_distribution<float> position(0.f, _extent);
+        std::uniform_real_distribution<float> radius(0.5f, 5.f);
+        std::uniform_real_distribution<float> value(-80.f, 0.f);
+
+        resize(_numEvents);
+        for (size_t i = 0; i < _numEvents; ++i)
+        {
+            const fivox::Vector3f pos(position(generator), position(generator),
+                                      position(generator));
+            update(i, pos, radius(generator), value(generator));
+        }
+    }
+
+private:
+    fivox::Vector2f _getTimeRange() const final
+    {
+        return fivox::Vector2f(0.f, 1.f);
+    }
+    ssize_t _load(size_t, size_t) final { return getNumEvents(); }
+    fivox::SourceType _getType() const final
+    {
+        return fivox::SourceType::frame;
+    }
+    size_t _getNumChunks() const final { return 1; }
+};
+}
@@ -55,10 +55,13 @@
 #include <itkStatisticsImageFilter.h>
 #include <itkTimeProbe.h>
 
+#include <lunchbox/log.h>
 #include <lunchbox/pluginRegisterer.h>
 #include <lunchbox/sleep.h>
 
+#include <fstream>
 #include <iomanip>
+#include <sstream>
 
 #define STARTUP_DELAY 250
 #define WRITE_DELAY 100
@@ -68,6 +71,50 @@ namespace
 const std::string _monsteerPluginScheme("monsteer");
 const size_t _minResolution = 8;
 
+// the serial event creation which createCompartmentEvents() parallelizes
+fivox::EventGeometryPtr createSerialEvents(
+    const brain::neuron::Morphologies& morphologies,
+    const brion::CompartmentReport& report, const bool somasOnly)
+{
+    const auto& mapping = fivox::helpers::computeInverseMapping(report);
+    size_t size = 0;
+    for (const auto& element : mapping)
+        if (!somasOnly || std::get<2>(element) == 0)
+            size += std::get<3>(element);
+    auto output = std::make_shared<fivox::EventGeometry>(size);
+
+    size_t index = 0;
+    for (const auto& element : mapping)
+    {
+        const auto& morphology = *morphologies[std::get<1>(element)];
+        const uint32_t sectionId = std::get<2>(element);
+        const uint16_t compartments = std::get<3>(element);
+        if (sectionId == 0)
+        {
+            const auto& soma = morphology.getSoma();
+            for (size_t k = 0; k != compartments; ++k)
+                output->update(index++, soma.getCentroid(),
+                               soma.getMeanRadius());
+            continue;
+        }
+        if (somasOnly)
+            continue;
+
+        const float normLength = 1.f / float(compartments);
+        brion::floats samples;
+        float k = normLength * .5f;
+        for (size_t j = 0; j != compartments; ++j, k += normLength)
+            samples.push_back(k);
+
+        const auto& section = morphology.getSection(sectionId);
+        const float compartmentLength = normLength * section.getLength();
+        for (const auto& point : section.getSamples(samples))
+            output->update(index++, point.get_sub_vector<3, 0>(),
+                           compartmentLength * .2f);
+    }
+    return output;
+}
+
 void testGenericEvents(fivox::EventSourcePtr eventsource)
 {
     boost::filesystem::path tempFile = boost::filesystem::unique_path();
@@ -75,9 +122,12 @@ void testGenericEvents(fivox::EventSourcePtr eventsource)
                             "/" + tempFile.string() + ".ascii";
     std::string binaryFile = boost::filesystem::temp_directory_path().string() +
                              "/" + tempFile.string() + ".binary";
+    std::string mappedFile = boost::filesystem::temp_directory_path().string() +
+                             "/" + tempFile.string() + ".mapped";
 
     BOOST_CHECK(eventsource->write(asciiFile, fivox::EventFileFormat::ascii));
     BOOST_CHECK(eventsource->write(binaryFile, fivox::EventFileFormat::binary));
+    BOOST_CHECK(eventsource->write(mappedFile, fivox::EventFileFormat::mapped));
 
     fivox::URIHandler asciiSourceURI(servus::URI("fivox://" + asciiFile));
     fivox::GenericLoader asciiSource(asciiSourceURI);
@@ -85,23 +135,66 @@ void testGenericEvents(fivox::EventSourcePtr eventsource)
     fivox::URIHandler binarySourceURI(servus::URI("fivox://" + binaryFile));
     fivox::GenericLoader binarySource(binarySourceURI);
 
+    fivox::URIHandler mappedSourceURI(servus::URI("fivox://" + mappedFile));
+    fivox::GenericLoader mappedSource(mappedSourceURI);
+
     BOOST_CHECK_EQUAL(eventsource->getNumEvents(), asciiSource.getNumEvents());
     BOOST_CHECK_EQUAL(eventsource->getNumEvents(), binarySource.getNumEvents());
+    BOOST_CHECK_EQUAL(eventsource->getNumEvents(), mappedSource.getNumEvents());
 
     for (uint32_t i = 0; i < asciiSource.getNumEvents(); ++i)
     {
+        BOOST_CHECK_CLOSE(asciiSource.getRadii()[i],
+                          eventsource->getRadii()[i], 0.001f);
         BOOST_CHECK_CLOSE(asciiSource.getValues()[i],
                           eventsource->getValues()[i], 0.001f);
     }
 
     for (uint32_t i = 0; i < binarySource.getNumEvents(); ++i)
     {
+        BOOST_CHECK_CLOSE(binarySource.getRadii()[i],
+                          eventsource->getRadii()[i], 0.001f);
         BOOST_CHECK_CLOSE(binarySource.getValues()[i],
                           eventsource->getValues()[i], 0.001f);
     }
 
+    // the mapped file holds the events exactly as in memory
+    for (uint32_t i = 0; i < mappedSource.getNumEvents(); ++i)
+    {
+        BOOST_CHECK_EQUAL(mappedSource.getPositionsX()[i],
+                          eventsource->getPositionsX()[i]);
+        BOOST_CHECK_EQUAL(mappedSource.getPositionsY()[i],
+                          eventsource->getPositionsY()[i]);
+        BOOST_CHECK_EQUAL(mappedSource.getPositionsZ()[i],
+                          eventsource->getPositionsZ()[i]);
+        BOOST_CHECK_EQUAL(mappedSource.getRadii()[i],
+                          eventsource->getRadii()[i]);
+        BOOST_CHECK_EQUAL(mappedSource.getValues()[i],
+                          eventsource->getValues()[i]);
+    }
+
+    // the first version 2 files had zeros after the column size, for
+    // inverted radii
+    const std::string plainFile = mappedFile + ".nometadata";
+    boost::filesystem::copy_file(mappedFile, plainFile);
+    {
+        std::fstream file(plainFile, std::ios::in | std::ios::out |
+                                         std::ios::binary);
+        const std::vector<char> zeros(80, 0);
+        file.seekp(48);
+        file.write(zeros.data(), zeros.size());
+    }
+    fivox::URIHandler plainSourceURI(servus::URI("fivox://" + plainFile));
+    fivox::GenericLoader plainSource(plainSourceURI);
+    BOOST_CHECK_EQUAL(eventsource->getNumEvents(), plainSource.getNumEvents());
+    for (uint32_t i = 0; i < plainSource.getNumEvents(); ++i)
+        BOOST_CHECK_EQUAL(plainSource.getRadii()[i],
+                          eventsource->getRadii()[i]);
+
     boost::filesystem::remove(asciiFile);
     boost::filesystem::remove(binaryFile);
+    boost::filesystem::remove(mappedFile);
+    boost::filesystem::remove(plainFile);
 }
 
 template <typename Image>
@@ -285,8 +378,188 @@ BOOST_AUTO_TEST_CASE(fivoxVSD_source)
                -85293.598821282387f, vmml::Vector2ui(0, 100));
 }
 
+BOOST_AUTO_TEST_CASE(fivoxVoltages_value_cache)
+{
+    const std::string filename =
+        (boost::filesystem::temp_directory_path() /
+         boost::filesystem::unique_path())
+            .string();
+    fivox::CompartmentLoader reference(
+        fivox::URIHandler(fivox::URI("fivoxcompartments://")));
+    const fivox::URIHandler params(
+        fivox::URI("fivoxcompartments://?valueCache=" + filename));
+
+    // the first source writes the frames, the second one reads them
+    for (size_t i = 0; i < 2; ++i)
+    {
+        fivox::CompartmentLoader source(params);
+        for (uint32_t frame = 0; frame < 3; ++frame)
+        {
+            BOOST_CHECK(reference.setFrame(frame));
+            BOOST_CHECK(source.setFrame(frame));
+            const ssize_t numEvents = reference.load();
+            BOOST_CHECK_EQUAL(source.load(), numEvents);
+            BOOST_CHECK_EQUAL_COLLECTIONS(source.getValues(),
+                                          source.getValues() + numEvents,
+                                          reference.getValues(),
+                                          reference.getValues() + numEvents);
+        }
+    }
+    boost::filesystem::remove(filename);
+}
+
+BOOST_AUTO_TEST_CASE(fivoxVoltages_prefetch)
+{
+    const fivox::URIHandler params(fivox::URI("fivoxcompartments://"));
+    const auto check = [&params](fivox::CompartmentLoader& source,
+                                 const uint32_t frame) {
+        // the first load of a new source is not prefetched
+        fivox::CompartmentLoader reference(params);
+        BOOST_CHECK(reference.setFrame(frame));
+        BOOST_CHECK(source.setFrame(frame));
+        const ssize_t numEvents = reference.load();
+        BOOST_REQUIRE_EQUAL(source.load(), numEvents);
+        BOOST_CHECK_EQUAL_COLLECTIONS(source.getValues(),
+                                      source.getValues() + numEvents,
+                                      reference.getValues(),
+                                      reference.getValues() + numEvents);
+    };
+
+    // stride detection in order, strided, reversed and at random, each
+    // sequence starting with a seek which drops the prefetched frame
+    const std::vector<std::vector<uint32_t>> sequences = {
+        {0, 1, 2, 3, 4}, {10, 13, 16, 19}, {40, 38, 36, 34}, {7, 2, 50, 51, 5}};
+    fivox::CompartmentLoader source(params);
+    for (const auto& sequence : sequences)
+        for (const uint32_t frame : sequence)
+            check(source, frame);
+
+    // read-ahead within a frame window, and seeks in and out of it
+    fivox::CompartmentLoader windowed(
+        fivox::URIHandler(fivox::URI("fivoxcompartments://?readAhead=2")));
+    windowed.setFrameWindow(fivox::Vector2ui(20, 30));
+    for (const uint32_t frame : {20, 21, 22, 25, 26, 29, 30, 31, 21, 24, 23})
+        check(windowed, frame);
+}
+
+BOOST_AUTO_TEST_CASE(fivoxVoltages_parallel_events)
+{
+    const fivox::URIHandler params(fivox::URI("fivoxcompartments://"));
+    const brion::CompartmentReport report(
+        params.getConfig().getReportSource(params.getReport()),
+        brion::MODE_READ, params.getGIDs());
+    const brain::Circuit circuit(params.getConfig());
+    const auto morphologies =
+        circuit.loadMorphologies(params.getGIDs(),
+                                 brain::Circuit::Coordinates::global);
+
+    for (const bool somasOnly : {false, true})
+    {
+        const auto events = fivox::helpers::createCompartmentEvents(
+            morphologies, report, somasOnly);
+        const auto reference =
+            createSerialEvents(morphologies, report, somasOnly);
+
+        const size_t numEvents = reference->getNumEvents();
+        BOOST_REQUIRE_EQUAL(events->getNumEvents(), numEvents);
+        BOOST_CHECK_GT(numEvents, 0);
+        const auto equal = [numEvents](const float* a, const float* b) {
+            BOOST_CHECK_EQUAL_COLLECTIONS(a, a + numEvents, b, b + numEvents);
+        };
+        equal(events->getPositionsX(), reference->getPositionsX());
+        equal(events->getPositionsY(), reference->getPositionsY());
+        equal(events->getPositionsZ(), reference->getPositionsZ());
+        equal(events->getRadii(), reference->getRadii());
+        BOOST_CHECK_EQUAL(events->getBoundingBox().getMin(),
+                          reference->getBoundingBox().getMin());
+        BOOST_CHECK_EQUAL(events->getBoundingBox().getMax(),
+                          reference->getBoundingBox().getMax());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(fivoxVoltages_geometry_cache)
+{
+    const boost::filesystem::path directory =
+        boost::filesystem::temp_directory_path() /
+        boost::filesystem::unique_path();
+    boost::filesystem::create_directory(directory);
+    const fivox::URIHandler params(fivox::URI(
+        "fivoxcompartments://?geometryCache=" + directory.string()));
+
+    // the first source writes the events, the second one maps them
+    std::vector<float> positions;
+    for (size_t i = 0; i < 2; ++i)
+    {
+        fivox::CompartmentLoader source(params);
+        const size_t numEvents = source.getNumEvents();
+        BOOST_CHECK(!boost::filesystem::is_empty(directory));
+        if (i == 0)
+        {
+            positions.assign(source.getPositionsX(),
+                             source.getPositionsX() + numEvents);
+            continue;
+        }
+        BOOST_CHECK_EQUAL_COLLECTIONS(source.getPositionsX(),
+                                      source.getPositionsX() + numEvents,
+                                      positions.begin(), positions.end());
+    }
+    boost::filesystem::remove_all(directory);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
+BOOST_AUTO_TEST_CASE(generic_ascii_events)
+{
+    const std::string filename =
+        (boost::filesystem::temp_directory_path() /
+         boost::filesystem::unique_path())
+            .string();
+    fivox::GenericLoader source(fivox::URIHandler(fivox::URI("fivox://")));
+    const auto read = [&](const std::string& contents) {
+        std::ofstream(filename) << contents;
+        return source.read(filename);
+    };
+
+    // comments, empty lines, no newline at the end
+    BOOST_CHECK(read("# events\nNumber of events: 2\n1 2 3 1 5\n\n"
+                     "# comment\n-1.5e2 .5 3. 2 6"));
+    BOOST_REQUIRE_EQUAL(source.getNumEvents(), 2);
+    BOOST_CHECK_EQUAL(source.getPositionsX()[0], 1.f);
+    BOOST_CHECK_EQUAL(source.getPositionsX()[1], -150.f);
+    BOOST_CHECK_EQUAL(source.getPositionsY()[1], .5f);
+    BOOST_CHECK_EQUAL(source.getPositionsZ()[1], 3.f);
+    BOOST_CHECK_EQUAL(source.getRadii()[1], 2.f);
+    BOOST_CHECK_EQUAL(source.getValues()[1], 6.f);
+
+    BOOST_CHECK(!read("Number of events: 2\n1 2 3 1 5\n1 2 3 1\n"));
+    BOOST_CHECK(!read("Number of events: 2\n1 2 3 1 5\n1 2 3 1 6 7\n"));
+    BOOST_CHECK(!read("Number of events: 1\n1 2 3 1 5\n1 2 3 1 6\n"));
+    BOOST_CHECK(!read("Number of events: 1\n1 2 x 1 5\n"));
+
+    // numbers run together, reported with the line of the event
+    std::ostringstream log;
+    lunchbox::Log::setOutput(log);
+    BOOST_CHECK(
+        !read("Number of events: 2\n# comment\n1 2 3 4 5\n1-2 3 4 5\n"));
+    BOOST_CHECK(log.str().find("line 4 ill-formed") != std::string::npos);
+    log.str(std::string());
+    BOOST_CHECK(!read("Number of events: 1\n\n1.5.3 2 3 4\n"));
+    BOOST_CHECK(log.str().find("line 3 ill-formed") != std::string::npos);
+    lunchbox::Log::resetOutput();
+    boost::filesystem::remove(filename);
+}
+
+BOOST_AUTO_TEST_CASE(compartment_events_gids_hash)
+{
+    // identify the cells of the shared events, previously with hash*31+gid
+    BOOST_CHECK_NE(fivox::helpers::computeGIDsHash({0, 100}),
+                   fivox::helpers::computeGIDsHash({1, 69}));
+    BOOST_CHECK_NE(fivox::helpers::computeGIDsHash({1, 2}),
+                   fivox::helpers::computeGIDsHash({1, 2, 3}));
+    BOOST_CHECK_EQUAL(fivox::helpers::computeGIDsHash({5, 6}),
+                      fivox::helpers::computeGIDsHash({6, 5}));
+}
+
 #if FIVOX_USE_MONSTEER
 
 BOOST_AUTO_TEST_CASE(fivoxSpikes_stream_source_frame_range)